@@ -0,0 +1,131 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+
+// Heap growth of the columns and arenas is counted, so it can be checked
+// that a tick in a steady state doesn't allocate at all.
+
+struct AllocationCounters
+{
+	long long allocations; // mallocs and reallocs, accessed atomically
+	long long bytes; // requested by them, accessed atomically
+};
+
+AllocationCounters allocationCounters;
+
+inline void countAllocation(size_t bytes)
+{
+	__atomic_fetch_add(&allocationCounters.allocations, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&allocationCounters.bytes, (long long) bytes, __ATOMIC_RELAXED);
+}
+
+inline long long allocationCount()
+{
+	return __atomic_load_n(&allocationCounters.allocations, __ATOMIC_RELAXED);
+}
+
+// length to grow an array of length len to so it holds needed elements,
+// at least doubles so that growing element by element stays cheap
+inline int grownLength(int len, int needed, int minimum = 256)
+{
+	int grown = len * 2 > minimum ? len * 2 : minimum;
+	return grown > needed ? grown : needed;
+}
+
+bool growColumn(void** column, int len, size_t size)
+{
+	countAllocation(len * size);
+	void* newarray = realloc(*column, len * size);
+	if (!newarray)
+		return false;
+	*column = newarray;
+	return true;
+}
+
+// Region allocator. Allocations are bumped out of large blocks and never
+// freed one by one, resetting the arena drops all of them at once. The
+// blocks are kept for reuse, so filling an arena again after a reset
+// doesn't touch the heap unless it needs more than last time.
+
+#define ARENA_BLOCK_SIZE (64 * 1024)
+#define ARENA_ALIGNMENT 16
+
+struct ArenaBlock
+{
+	ArenaBlock* next;
+	size_t size;
+	size_t used;
+	// the memory follows the header, which is a multiple of ARENA_ALIGNMENT
+};
+
+struct Arena
+{
+	ArenaBlock* first;
+	ArenaBlock* current;
+};
+
+inline size_t arenaHeaderSize()
+{
+	return (sizeof(ArenaBlock) + ARENA_ALIGNMENT - 1) & ~(size_t) (ARENA_ALIGNMENT - 1);
+}
+
+// returns size bytes aligned to ARENA_ALIGNMENT, or NULL if no block could be allocated
+void* arenaAlloc(Arena* arena, size_t size)
+{
+	size = (size + ARENA_ALIGNMENT - 1) & ~(size_t) (ARENA_ALIGNMENT - 1);
+	ArenaBlock* block = arena->current;
+	while (block && block->used + size > block->size)
+	{
+		// move on to a block kept from before the last reset
+		block = block->next;
+		if (block)
+			block->used = 0;
+	}
+	if (!block)
+	{
+		size_t blockSize = size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE;
+		countAllocation(arenaHeaderSize() + blockSize);
+		block = (ArenaBlock*) malloc(arenaHeaderSize() + blockSize);
+		if (!block)
+		{
+			LOG_ERROR("Couldn't allocate %zu bytes for the arena.\n", blockSize);
+			return NULL;
+		}
+		block->size = blockSize;
+		block->used = 0;
+		// chain it in after the current block, so it is found again after a reset
+		if (arena->current)
+		{
+			block->next = arena->current->next;
+			arena->current->next = block;
+		} else {
+			block->next = arena->first;
+			arena->first = block;
+		}
+	}
+	arena->current = block;
+	void* memory = (char*) block + arenaHeaderSize() + block->used;
+	block->used += size;
+	return memory;
+}
+
+// drops everything allocated from the arena, keeps the blocks
+void arenaReset(Arena* arena)
+{
+	arena->current = arena->first;
+	if (arena->first)
+		arena->first->used = 0;
+}
+
+void arenaFree(Arena* arena)
+{
+	ArenaBlock* block = arena->first;
+	while (block)
+	{
+		ArenaBlock* next = block->next;
+		free(block);
+		block = next;
+	}
+	arena->first = NULL;
+	arena->current = NULL;
+}
\ No newline at end of file
@@ -0,0 +1,206 @@
+// Headless benchmark, runs the simulation with fixed steps and without SDL or OpenGL.
+// usage: oofbench [--seed N] [--player N] [--enemy N] [--planets N] [--ticks N] [--threads N]
+//                 [--presence exact|approx|compare] [--max-error F] [--load FILE] [--save FILE]
+//                 [--replay FILE] [--spawn-budget N]
+// --load starts from a save file instead of a new game, --save writes the final state
+// --replay runs an input recording (F7 in the game) from its starting state, frame by frame
+// builds with -DPROFILE also take [--trace FILE] to write a Chrome trace of the last ticks
+
+#define HEADLESS
+
+#include <stdio.h>
+#include <string.h>
+#include <fenv.h>
+#include "game.c"
+
+#define BENCH_STEP 0.016f
+
+void spawnBenchShips(int count, int team, Vectorf p1, Vectorf p2)
+{
+	RandomStream r = randomStream(game.seed, rng_bench, team);
+	for (int i = 0; i < count; i++)
+	{
+		spawnShip(randomBetween(&r, p1, p2), i % 3, team);
+	}
+}
+
+int main(int argc, char const *argv[])
+{
+	// make sure to catch sources of NAN and INF
+	feenableexcept(FE_INVALID | FE_OVERFLOW);
+
+	int seed = 1377613843;
+	int playerShips = 1000;
+	int enemyShips = 1000;
+	int planets = 15;
+	int ticks = 1000;
+	int threads = 0;
+	int presenceMode = presence_approx;
+	float maxError = 0.01f;
+	const char* trace = NULL;
+	const char* load = NULL;
+	const char* save = NULL;
+	const char* replayFile = NULL;
+	int spawnBudget = WAVE_SPAWN_BUDGET;
+	for (int i = 1; i < argc; i++)
+	{
+		if (i + 1 >= argc)
+		{
+			printf("Missing value for %s\n", argv[i]);
+			return 1;
+		}
+		int value = strtol(argv[i + 1], NULL, 10);
+		if (strcmp(argv[i], "--seed") == 0)
+			seed = value;
+		else if (strcmp(argv[i], "--player") == 0)
+			playerShips = value;
+		else if (strcmp(argv[i], "--enemy") == 0)
+			enemyShips = value;
+		else if (strcmp(argv[i], "--planets") == 0)
+			planets = value;
+		else if (strcmp(argv[i], "--ticks") == 0)
+			ticks = value;
+		else if (strcmp(argv[i], "--threads") == 0)
+			threads = value;
+		else if (strcmp(argv[i], "--trace") == 0)
+			trace = argv[i + 1];
+		else if (strcmp(argv[i], "--load") == 0)
+			load = argv[i + 1];
+		else if (strcmp(argv[i], "--save") == 0)
+			save = argv[i + 1];
+		else if (strcmp(argv[i], "--replay") == 0)
+			replayFile = argv[i + 1];
+		else if (strcmp(argv[i], "--spawn-budget") == 0)
+			spawnBudget = value;
+		else if (strcmp(argv[i], "--max-error") == 0)
+			maxError = strtof(argv[i + 1], NULL);
+		else if (strcmp(argv[i], "--presence") == 0 && strcmp(argv[i + 1], "exact") == 0)
+			presenceMode = presence_exact;
+		else if (strcmp(argv[i], "--presence") == 0 && strcmp(argv[i + 1], "approx") == 0)
+			presenceMode = presence_approx;
+		else if (strcmp(argv[i], "--presence") == 0 && strcmp(argv[i + 1], "compare") == 0)
+			presenceMode = presence_compare;
+		else
+		{
+			printf("Unknown option %s\n", argv[i]);
+			printf("usage: %s [--seed N] [--player N] [--enemy N] [--planets N] [--ticks N] [--threads N]\n", argv[0]);
+			printf("       [--presence exact|approx|compare] [--max-error F] [--trace FILE]\n");
+			printf("       [--load FILE] [--save FILE] [--replay FILE] [--spawn-budget N]\n");
+			return 1;
+		}
+		i++;
+	}
+	if (planets < 1)
+		planets = 1;
+
+	initLog();
+	initBatchKernels();
+	initJobs(threads);
+	initGameValues();
+	game.presenceMode = presenceMode;
+	game.presenceMaxError = maxError;
+	game.spawnBudget = max(spawnBudget, 1);
+	loadAssets();
+	createUI();
+	initInputQueue(&game.inputs);
+
+	InputReplay replay;
+	memset(&replay, 0, sizeof(InputReplay));
+	if (replayFile)
+	{
+		if (!loadReplay(&replay, replayFile))
+		{
+			shutdownJobs();
+			shutdownLog();
+			return 1;
+		}
+		load = replay.startFile;
+		ticks = replay.numFrames;
+	}
+
+	if (load)
+	{
+		if (!loadGame(load))
+		{
+			shutdownJobs();
+			shutdownLog();
+			return 1;
+		}
+	} else {
+		newGame(seed, 250, planets);
+
+		// player ships around the home planet, enemies where the waves come in
+		Vectorf home = game.planets[0].position;
+		spawnBenchShips(playerShips, 0, vecadd(home, vecf(-50.f, -50.f)), vecadd(home, vecf(50.f, 50.f)));
+		spawnBenchShips(enemyShips, 1, vecsub(game.nextWave.spawnAreaP1, vecf(0.f, 50.f)), game.nextWave.spawnAreaP2);
+	}
+
+	for (int i = 0; i < num_phases; i++)
+		game.phaseTime[i] = 0.0;
+
+	float presenceError = 0.f;
+	long long allocations = allocationCount();
+	int allocatingTicks = 0;
+	int lastAllocatingTick = -1;
+	double start = monotonicTime();
+	for (int i = 0; i < ticks; i++)
+	{
+		long long before = allocationCount();
+		if (replayFile)
+		{
+			replayFrame(&replay, &game.inputs, i);
+			simulateFrame(1.0 / replay.frameRate);
+		} else {
+			game.spawnBudgetLeft = game.spawnBudget; // every tick is a frame of its own
+			tickGame(BENCH_STEP);
+		}
+		presenceError = max(presenceError, game.presenceError);
+		if (allocationCount() != before)
+		{
+			allocatingTicks++;
+			lastAllocatingTick = i;
+		}
+		PROFILE_END_FRAME();
+	}
+	double total = monotonicTime() - start;
+
+	// the recording stopped before the last frame was simulated, but after its first inputs were applied
+	bool replayMatches = true;
+	if (replayFile)
+	{
+		replayFrame(&replay, &game.inputs, ticks);
+		applyInputs();
+		replayMatches = gameChecksum() == replay.checksum;
+	}
+
+	int shipCount[2] = {0, 0};
+	for (int i = 0; i < game.ships.num; i++)
+		shipCount[game.ships.team[i]]++;
+
+	printf("\n%d ticks in %.3f s, %.1f ticks/s\n", ticks, total, ticks / total);
+	printf("%-12s %10s\n", "phase", "ms/tick");
+	for (int i = 0; i < num_phases; i++)
+		printf("%-12s %10.4f\n", phaseNames[i], game.phaseTime[i] * 1000.0 / ticks);
+	printf("ships: %d player, %d enemy\n", shipCount[0], shipCount[1]);
+	printf("heap allocations: %lld in %d ticks, the last in tick %d\n", allocationCount() - allocations, allocatingTicks, lastAllocatingTick);
+	if (presenceMode == presence_compare)
+		printf("presence error: %f (allowed %f)\n", presenceError, maxError);
+	printf("checksum: %016llx\n", (unsigned long long) gameChecksum());
+	if (!replayMatches)
+		printf("The replay ended with a different state than the recording, which ended with checksum %016llx!\n", replay.checksum);
+	if (save)
+		saveGame(save);
+
+#ifdef PROFILE
+	if (trace)
+		profileWriteTrace(trace);
+#else
+	if (trace)
+		printf("Not built with -DPROFILE, no trace written\n");
+#endif
+
+	freeReplay(&replay);
+	shutdownJobs();
+	shutdownLog();
+	return replayMatches ? 0 : 1;
+}
@@ -0,0 +1,151 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <SDL2/SDL_opengl.h>
+
+// Batched drawing. Geometry is collected on the cpu into DrawBatches, one per
+// primitive type, then all batches are streamed into a single vertex buffer
+// and drawn with one glDrawArrays call each.
+
+struct DrawVertex
+{
+	float x;
+	float y;
+	GLubyte color[4];
+};
+
+struct DrawColor
+{
+	GLubyte rgba[4];
+};
+
+struct DrawBatch
+{
+	GLenum mode;
+	DrawVertex *vertices;
+	int num;
+	int len;
+};
+
+inline GLubyte drawColorChannel(float f)
+{
+	if (f <= 0.f)
+		return 0;
+	if (f >= 1.f)
+		return 255;
+	return (GLubyte) (f * 255.f + 0.5f);
+}
+
+// clamps like glColor3f does
+inline DrawColor drawColor(float r, float g, float b, float a = 1.f)
+{
+	DrawColor c;
+	c.rgba[0] = drawColorChannel(r);
+	c.rgba[1] = drawColorChannel(g);
+	c.rgba[2] = drawColorChannel(b);
+	c.rgba[3] = drawColorChannel(a);
+	return c;
+}
+
+void drawBatchBegin(DrawBatch* batch, GLenum mode)
+{
+	batch->mode = mode;
+	batch->num = 0;
+}
+
+// makes room for count more vertices and returns the first of them
+DrawVertex* drawBatchAlloc(DrawBatch* batch, int count)
+{
+	if (batch->num + count > batch->len)
+	{
+		int len = batch->len > 0 ? batch->len : 1024;
+		while (len < batch->num + count)
+			len *= 2;
+		DrawVertex* newarray = (DrawVertex*) realloc(batch->vertices, len * sizeof(DrawVertex));
+		if (!newarray)
+		{
+			LOG_ERROR("Couldn't increase draw batch size, dropping vertices.\n");
+			return NULL;
+		}
+		batch->vertices = newarray;
+		batch->len = len;
+	}
+	DrawVertex* v = &batch->vertices[batch->num];
+	batch->num += count;
+	return v;
+}
+
+inline void drawBatchVertex(DrawBatch* batch, float x, float y, DrawColor color)
+{
+	DrawVertex* v = drawBatchAlloc(batch, 1);
+	if (!v)
+		return;
+	v->x = x;
+	v->y = y;
+	memcpy(v->color, color.rgba, 4);
+}
+
+// axis aligned square around (x, y), for GL_QUADS batches
+void drawBatchSquare(DrawBatch* batch, float x, float y, float r, DrawColor color)
+{
+	drawBatchVertex(batch, x - r, y - r, color);
+	drawBatchVertex(batch, x + r, y - r, color);
+	drawBatchVertex(batch, x + r, y + r, color);
+	drawBatchVertex(batch, x - r, y + r, color);
+}
+
+// convex polygon around (x, y) given as offsets, for GL_TRIANGLES batches
+void drawBatchPolygon(DrawBatch* batch, float x, float y, const Vectorf* shape, int numPoints, DrawColor color)
+{
+	for (int i = 1; i + 1 < numPoints; i++)
+	{
+		drawBatchVertex(batch, x + shape[0].x, y + shape[0].y, color);
+		drawBatchVertex(batch, x + shape[i].x, y + shape[i].y, color);
+		drawBatchVertex(batch, x + shape[i + 1].x, y + shape[i + 1].y, color);
+	}
+}
+
+// for GL_LINES batches
+void drawBatchLine(DrawBatch* batch, float x1, float y1, float x2, float y2, DrawColor color)
+{
+	drawBatchVertex(batch, x1, y1, color);
+	drawBatchVertex(batch, x2, y2, color);
+}
+
+// uploads the batches into buffer (created on first use) and draws them in order
+void drawBatches(GLuint* buffer, DrawBatch** batches, int numBatches)
+{
+	int total = 0;
+	for (int i = 0; i < numBatches; i++)
+		total += batches[i]->num;
+	if (total == 0)
+		return;
+
+	if (*buffer == 0)
+		glGenBuffers(1, buffer);
+	glBindBuffer(GL_ARRAY_BUFFER, *buffer);
+	// orphan last frame's storage so the driver doesn't have to wait for it
+	glBufferData(GL_ARRAY_BUFFER, total * sizeof(DrawVertex), NULL, GL_STREAM_DRAW);
+	int first = 0;
+	for (int i = 0; i < numBatches; i++)
+	{
+		glBufferSubData(GL_ARRAY_BUFFER, first * sizeof(DrawVertex), batches[i]->num * sizeof(DrawVertex), batches[i]->vertices);
+		first += batches[i]->num;
+	}
+
+	glEnableClientState(GL_VERTEX_ARRAY);
+	glEnableClientState(GL_COLOR_ARRAY);
+	glVertexPointer(2, GL_FLOAT, sizeof(DrawVertex), (const void*) offsetof(DrawVertex, x));
+	glColorPointer(4, GL_UNSIGNED_BYTE, sizeof(DrawVertex), (const void*) offsetof(DrawVertex, color));
+	first = 0;
+	for (int i = 0; i < numBatches; i++)
+	{
+		if (batches[i]->num > 0)
+			glDrawArrays(batches[i]->mode, first, batches[i]->num);
+		first += batches[i]->num;
+	}
+	glDisableClientState(GL_COLOR_ARRAY);
+	glDisableClientState(GL_VERTEX_ARRAY);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
\ No newline at end of file
@@ -1,12 +1,33 @@
 #include <stdio.h>
 #include <stdbool.h> 
-#include <SDL2/SDL.h>
-#include <SDL2/SDL_opengl.h>
-#include <GL/glu.h>
+#ifndef HEADLESS
+	#define GL_GLEXT_PROTOTYPES // buffer objects are core in 1.5, but not in the headers
+	#include <SDL2/SDL.h>
+	#include <SDL2/SDL_opengl.h>
+	#include <GL/glu.h>
+#endif
 #include <stdlib.h>
+#include <stdint.h>
 #include <math.h>
+#include <time.h>
+#include "log.c"
+#include "profiler.c"
+#include "arena.c"
 #include "vectors.c"
+#include "random.c"
+#include "input.c"
+#include "spatialgrid.c"
+#include "planetgrid.c"
+#include "schedule.c"
+#include "shipstore.c"
+#include "presence.c"
+#include "snapshot.c"
+#include "savefile.c"
+#include "jobs.c"
 #include "textures.c"
+#ifndef HEADLESS
+	#include "drawbatch.c"
+#endif
 #include "oofgui.c"
 
 #define PI 3.14159265358979323846
@@ -18,6 +39,51 @@
 #define rsc_sbm 1
 #define rsc_food 2
 
+#define num_buildings 8 // building types, 0 is an empty tile
+#define first_shipyard 5 // building types 5 to 7 build ships of types 0 to 2
+
+// seconds between the ships of a shipyard, production happens when the game
+// age passes a whole second one above a multiple of the period
+const int shipyardPeriods[3] = {2, 10, 30};
+
+// most ships a wave spawns per frame by default, see Game.spawnBudget
+#define WAVE_SPAWN_BUDGET 256
+
+// a few times the flocking radius, so sensor queries don't have to walk too many cells
+#define SHIP_GRID_CELL_SIZE 16.f
+
+// ships per job, fixed so the result doesn't depend on the number of threads
+#define SHIP_CHUNK_SIZE 256
+
+// how cruising ships pick a target among the enemies in sensor range
+#define target_nearest 0
+#define target_best 1 // highest damage modifier, then nearest
+// ships without target look for one every this many ticks
+#define TARGET_SCAN_INTERVAL 4
+
+// frames per second of the simulation loop, see simulateFrame
+#define SIM_TICK_RATE 60
+
+// how planet ship presence is computed
+#define presence_exact 0
+#define presence_approx 1
+#define presence_compare 2 // exact values, but measures the approximation error
+
+// tick phases, timed separately to see where the time goes
+#define phase_cleanup 0
+#define phase_waves 1
+#define phase_planets 2
+#define phase_presence 3
+#define phase_grid 4
+#define phase_targets 5
+#define phase_forces 6
+#define phase_damage 7
+#define phase_integrate 8
+#define phase_ui 9
+#define num_phases 10
+
+const char* phaseNames[num_phases] = {"cleanup", "waves", "planets", "presence", "grid", "targets", "forces", "damage", "integrate", "ui"};
+
 struct Tile
 {
 	// type 0 = none
@@ -42,6 +108,7 @@ struct Planet
 	int team;
 
 	float shipPresence[3];
+	int buildings[num_buildings]; // number of tiles with each building type, see setBuilding
 };
 
 struct ShipClass
@@ -57,24 +124,6 @@ struct ShipClass
 	float buildCost;
 };
 
-struct Ship
-{
-	Vectorf position;
-	Vectorf velocity;
-	Vectorf force;
-	// type 0 = fighter
-	//      1 = cruiser
-	//      2 = bomber
-	int type;
-	ShipClass* values;
-	// team 0 = player
-	//      1 = enemy
-	int team;
-	float health;
-	Ship* target;
-	float weaponTimer;
-};
-
 struct Wave
 {
 	float shipsToSpawn[3]; // float to make it easily scalable, i.e. x * 1.1
@@ -88,18 +137,38 @@ struct Wave
 struct Game
 {
 	float gameAge;
+	int tickCount;
 	int seed;
 	int galaxyRadius;
 
+	// planets, tiles and whatever else lives exactly as long as the game,
+	// clearGame resets it in one go
+	Arena arena;
+	Arena loadArena; // filled by loadGame, swapped with arena once the file checked out
 	Planet *planets;
 	int numPlanets;
 
 	ShipClass shipClasses[3];
-	int buildingPrices[8];
+	int buildingPrices[num_buildings];
+	int buildings[num_buildings]; // of all planets together
+	Schedule shipyards; // next production of every shipyard
+
+	ShipStore ships;
 
-	Ship *ships;
-	int numShips;
-	int lenShips;
+	// rebuilt every tick before the ships move
+	SpatialGrid shipGrid;
+	PresenceTree presenceTree;
+
+	// built once per game, the planets don't move
+	PlanetGrid planetGrid;
+	float *planetRanks; // per planet and ship type, what the grid bounds are built from
+
+	int targetMode;
+	int presenceMode;
+	int spawnBudget; // most ships the current wave spawns per frame
+	int spawnBudgetLeft; // of this frame, shared by all its ticks
+	float presenceMaxError; // allowed relative error of the approximate presence
+	float presenceError; // largest relative error of the last tick in compare mode
 
 	Wave nextWave;
 	Wave currentWave;
@@ -114,9 +183,18 @@ struct Game
 	Vectorf cameraShift;
 	float cameraZoom;
 
-	UIElement gui;
+	UI gui;
+	UIIndex guiIndex; // named elements of gui, built by createUI
+	int affordableBuildings; // bit per building type, the building selectors show this state
+	pthread_mutex_t uiLock; // gui is changed by the simulation and drawn by the renderer
 
-	Texture *textures;
+	// between the window thread and the simulation thread
+	InputQueue inputs;
+	InputRecorder recorder; // only used by the simulation thread
+	SnapshotBuffer snapshots;
+
+	TextureAtlas atlas;
+	Texture *textures; // regions of atlas
 	int numTextures;
 
 	// 0: none
@@ -127,68 +205,512 @@ struct Game
 	float speedModifier;
 	float leftoverStep;
 	bool steplimiting;
+
+	// seconds spent in each tick phase, never reset by the game itself
+	double phaseTime[num_phases];
 };
 
 Game game;
 
+int logMaxLevel()
+{
+	return game.debuglevel >= 2 ? log_debug : log_info;
+}
+
+// named element of the gui, NULL if there is none
+inline UIElement* uiElement(const char* name)
+{
+	return findElement(&game.guiIndex, name);
+}
+
+// adds the time since *start to the phase and restarts the clock
+inline void endPhase(int phase, double* start)
+{
+	double now = monotonicTime();
+	game.phaseTime[phase] += now - *start;
+	PROFILE_RECORD(phaseNames, phase, *start, now);
+	*start = now;
+}
+
+// accessors for the ship columns
+
+inline Vectorf shipPosition(int i)
+{
+	return vecf(game.ships.x[i], game.ships.y[i]);
+}
+
+inline void setShipPosition(int i, Vectorf v)
+{
+	game.ships.x[i] = v.x;
+	game.ships.y[i] = v.y;
+}
+
+inline Vectorf shipVelocity(int i)
+{
+	return vecf(game.ships.vx[i], game.ships.vy[i]);
+}
+
+inline void setShipVelocity(int i, Vectorf v)
+{
+	game.ships.vx[i] = v.x;
+	game.ships.vy[i] = v.y;
+}
+
+inline Vectorf shipForce(int i)
+{
+	return vecf(game.ships.fx[i], game.ships.fy[i]);
+}
+
+inline void setShipForce(int i, Vectorf v)
+{
+	game.ships.fx[i] = v.x;
+	game.ships.fy[i] = v.y;
+}
+
+inline ShipClass* shipClass(int i)
+{
+	return &game.shipClasses[game.ships.type[i]];
+}
+
+inline ShipHandle shipHandle(int i)
+{
+	return shipStoreHandle(&game.ships, i);
+}
+
+// current index of the ship or -1 if it was destroyed
+inline int resolveShip(ShipHandle h)
+{
+	return shipStoreResolve(&game.ships, h);
+}
+
 void clearGame()
 {
 	game.speedModifier = 1.f;
 	game.leftoverStep = 0.0f;
 	game.steplimiting = false;
 	game.seed = 0;
+	game.tickCount = 0;
+	game.presenceError = 0.f;
 	game.galaxyRadius = 0;
 	game.cameraShift = vecf(0.f, 0.f);
 	game.cameraZoom = 1.f;
-	if (game.numPlanets > 0)
+	arenaReset(&game.arena);
+	game.planets = NULL;
+	game.planetRanks = NULL;
+	shipStoreClear(&game.ships);
+	game.numPlanets = 0;
+}
+
+// counts the buildings of every planet from scratch, once they are generated or loaded
+void countBuildings()
+{
+	memset(game.buildings, 0, sizeof(game.buildings));
+	for (int i = 0; i < game.numPlanets; i++)
 	{
-		for (int i = 0; i < game.numPlanets; i++)
+		Planet* p = &game.planets[i];
+		memset(p->buildings, 0, sizeof(p->buildings));
+		for (int t = 0; t < p->numTiles; t++)
 		{
-			free(game.planets[i].tiles);
+			p->buildings[p->tiles[t].buildingType]++;
+			game.buildings[p->tiles[t].buildingType]++;
 		}
-		free(game.planets);
 	}
-	game.numShips = 0;
-	game.numPlanets = 0;
 }
 
-Ship* spawnShip(Vectorf position, int type, int team)
+// the first production second of a shipyard built now
+int nextProduction(int type)
+{
+	int period = shipyardPeriods[type - first_shipyard];
+	int now = (int) game.gameAge;
+	return (now + period - 1) / period * period + 1;
+}
+
+// puts every shipyard into the schedule, once the planets are generated or loaded
+void scheduleShipyards()
 {
-	// expand array if necessary
-	if (game.numShips == game.lenShips)
+	scheduleClear(&game.shipyards);
+	for (int i = 0; i < game.numPlanets; i++)
 	{
-		printf("Increasing array size from %d to %d\n", game.lenShips, game.lenShips + 100);
-		game.lenShips += 100;
-		Ship* newarray = (Ship*) realloc(game.ships, game.lenShips * sizeof(Ship));
-		if (newarray)
+		for (int t = 0; t < game.planets[i].numTiles; t++)
 		{
-			game.ships = newarray;
+			int type = game.planets[i].tiles[t].buildingType;
+			if (type >= first_shipyard)
+				schedulePush(&game.shipyards, nextProduction(type), i, t);
 		}
-		else
+	}
+}
+
+// replaces the building on a tile, buildings must only be changed through this
+void setBuilding(Planet* p, int tile, int type)
+{
+	int old = p->tiles[tile].buildingType;
+	p->buildings[old]--;
+	game.buildings[old]--;
+	if (old >= first_shipyard)
+		scheduleRemove(&game.shipyards, p - game.planets, tile);
+	p->tiles[tile].buildingType = type;
+	p->buildings[type]++;
+	game.buildings[type]++;
+	if (type >= first_shipyard)
+		schedulePush(&game.shipyards, nextProduction(type), p - game.planets, tile);
+}
+
+// resources the buildings of all planets produce per tick, mines and farms
+// are deactivated while there is no energy, power plants and HQs never are
+Vectorf buildingProduction()
+{
+	int* n = game.buildings;
+	int energy = 3 * n[1] + 3 * n[3];
+	int sbm = 3 * n[1];
+	int food = 3 * n[1];
+	if (game.resources[rsc_energy] > 0)
+	{
+		energy -= 2 * n[2] + n[4];
+		sbm += 3 * n[2];
+		food += 3 * n[4];
+	}
+	return vecf(energy, sbm, food);
+}
+
+// indexes the planets, once they are all placed
+void buildPlanetGrid()
+{
+	game.planetRanks = (float*) arenaAlloc(&game.arena, game.numPlanets * PLANET_GRID_GROUPS * sizeof(float));
+	if (!planetGridBegin(&game.planetGrid, game.numPlanets))
+		return;
+	for (int i = 0; i < game.numPlanets; i++)
+		planetGridInsert(&game.planetGrid, i, game.planets[i].position, game.planets[i].radius);
+	planetGridFinish(&game.planetGrid);
+}
+
+// makes room for count more ships, the columns at least double when they
+// grow so spawning ship by ship only reallocates a few times
+bool reserveShips(int count)
+{
+	int needed = game.ships.num + count;
+	if (needed <= game.ships.len)
+		return true;
+	int len = grownLength(game.ships.len, needed, 1024);
+	LOG_DEBUG("Increasing array size from %d to %d\n", game.ships.len, len);
+	if (shipStoreReserve(&game.ships, len))
+		return true;
+	// doubling may ask for more than there is
+	return shipStoreReserve(&game.ships, needed);
+}
+
+// makes room for all ships the wave is still going to spawn
+bool reserveWave(Wave* wave)
+{
+	int count = 0;
+	for (int i = 0; i < 3; i++)
+		count += max(0, (int) ceilf(wave->shipsToSpawn[i]));
+	return reserveShips(count);
+}
+
+// spawns count ships of one type and team as one block, at positions drawn
+// from r between p1 and p2. Returns the index of the first or -1.
+int spawnShips(int count, int type, int team, RandomStream* r, Vectorf p1, Vectorf p2)
+{
+	if (!reserveShips(count))
+	{
+		LOG_ERROR("Couldn't increase array size, aborting spawn.\n");
+		return -1;
+	}
+
+	int first = shipStoreAddBlock(&game.ships, count);
+	float health = game.shipClasses[type].baseHealth;
+	for (int s = first; s < first + count; s++)
+	{
+		setShipPosition(s, randomBetween(r, p1, p2));
+		game.ships.type[s] = type;
+		game.ships.team[s] = team;
+		game.ships.health[s] = health;
+	}
+	return first;
+}
+
+// returns the index of the new ship or -1 if it couldn't be spawned
+int spawnShip(Vectorf position, int type, int team)
+{
+	if (!reserveShips(1))
+	{
+		LOG_ERROR("Couldn't increase array size, aborting spawn.\n");
+		return -1;
+	}
+
+	int s = shipStoreAdd(&game.ships);
+
+	setShipPosition(s, position);
+	game.ships.type[s] = type;
+	game.ships.team[s] = team;
+	game.ships.health[s] = shipClass(s)->baseHealth;
+	// printf("spawning ship #%d\n", game.ships.num);
+	return s;
+}
+
+// version of the save file format, bump it whenever saveGame changes
+#define SAVE_VERSION 2
+#define SAVE_MAX_PLANETS 100000
+#define SAVE_MAX_TILES 1024
+#define SAVE_MAX_SHIPS 10000000 // about 700 MB of columns, well below the 4 GB a save file can have
+
+// the smallest a planet and a ship take up in the file
+#define SAVE_PLANET_BYTES (sizeof(float) * 3 + sizeof(int) * 3 + sizeof(((Planet*) 0)->shipPresence))
+#define SAVE_SHIP_BYTES (sizeof(float) * 8 + sizeof(int) * 3 + sizeof(ShipHandle))
+
+void saveWave(SaveWriter* w, Wave* wave)
+{
+	saveWrite(w, wave->shipsToSpawn, sizeof(wave->shipsToSpawn));
+	saveWriteFloat(w, wave->countdown);
+	saveWriteFloat(w, wave->spawnAreaP1.x);
+	saveWriteFloat(w, wave->spawnAreaP1.y);
+	saveWriteFloat(w, wave->spawnAreaP2.x);
+	saveWriteFloat(w, wave->spawnAreaP2.y);
+	saveWriteInt(w, wave->waveNumber);
+}
+
+Wave loadWave(SaveReader* r)
+{
+	Wave wave;
+	saveRead(r, wave.shipsToSpawn, sizeof(wave.shipsToSpawn));
+	wave.countdown = saveReadFloat(r);
+	float x1 = saveReadFloat(r);
+	float y1 = saveReadFloat(r);
+	float x2 = saveReadFloat(r);
+	float y2 = saveReadFloat(r);
+	wave.spawnAreaP1 = vecf(x1, y1);
+	wave.spawnAreaP2 = vecf(x2, y2);
+	wave.waveNumber = saveReadInt(r);
+	return wave;
+}
+
+// writes the simulation state, everything that only concerns the view or the
+// window is left out
+bool saveGame(const char* filename)
+{
+	double start = monotonicTime();
+	SaveWriter w;
+	if (!openSaveWriter(&w, filename))
+		return false;
+	saveWriteHeader(&w);
+
+	saveWriteFloat(&w, game.gameAge);
+	saveWriteInt(&w, game.tickCount);
+	saveWriteInt(&w, game.seed);
+	saveWriteInt(&w, game.galaxyRadius);
+	saveWrite(&w, game.resources, sizeof(game.resources));
+	saveWriteFloat(&w, game.speedModifier);
+	saveWriteFloat(&w, game.leftoverStep);
+	saveWriteInt(&w, game.steplimiting);
+	saveWave(&w, &game.nextWave);
+	saveWave(&w, &game.currentWave);
+
+	saveWriteInt(&w, game.numPlanets);
+	for (int i = 0; i < game.numPlanets; i++)
+	{
+		Planet* p = &game.planets[i];
+		saveWriteFloat(&w, p->position.x);
+		saveWriteFloat(&w, p->position.y);
+		saveWriteFloat(&w, p->radius);
+		saveWriteInt(&w, p->seed);
+		saveWriteInt(&w, p->team);
+		saveWrite(&w, p->shipPresence, sizeof(p->shipPresence));
+		saveWriteInt(&w, p->numTiles);
+		saveWrite(&w, p->tiles, p->numTiles * sizeof(Tile));
+	}
+
+	// the ship columns as they are, targets are already handles
+	ShipStore* s = &game.ships;
+	saveWriteInt(&w, s->num);
+	saveWriteInt(&w, s->numSlots);
+	saveWriteInt(&w, s->numFreeSlots);
+	saveWrite(&w, s->x, s->num * sizeof(float));
+	saveWrite(&w, s->y, s->num * sizeof(float));
+	saveWrite(&w, s->vx, s->num * sizeof(float));
+	saveWrite(&w, s->vy, s->num * sizeof(float));
+	saveWrite(&w, s->fx, s->num * sizeof(float));
+	saveWrite(&w, s->fy, s->num * sizeof(float));
+	saveWrite(&w, s->health, s->num * sizeof(float));
+	saveWrite(&w, s->weaponTimer, s->num * sizeof(float));
+	saveWrite(&w, s->type, s->num * sizeof(int));
+	saveWrite(&w, s->team, s->num * sizeof(int));
+	saveWrite(&w, s->target, s->num * sizeof(ShipHandle));
+	saveWrite(&w, s->slot, s->num * sizeof(int));
+	saveWrite(&w, s->slotGeneration, s->numSlots * sizeof(int));
+	saveWrite(&w, s->freeSlots, s->numFreeSlots * sizeof(int));
+
+	if (!closeSaveWriter(&w, SAVE_VERSION))
+	{
+		LOG_ERROR("Couldn't write %s.\n", filename);
+		return false;
+	}
+	LOG_INFO("Saved %d ships and %d planets to %s in %.2f ms\n", s->num, game.numPlanets, filename, (monotonicTime() - start) * 1000.0);
+	return true;
+}
+
+// replaces the running game with the one in the file, the running game is
+// kept if the file can't be loaded
+bool loadGame(const char* filename)
+{
+	double start = monotonicTime();
+	SaveReader r;
+	if (!openSaveReader(&r, filename))
+		return false;
+	uint32_t version = saveReadHeader(&r);
+	if (!r.failed && version != SAVE_VERSION)
+	{
+		LOG_ERROR("Couldn't load %s, it is version %u instead of %d.\n", filename, version, SAVE_VERSION);
+		r.failed = true;
+	}
+
+	float gameAge = saveReadFloat(&r);
+	int tickCount = saveReadInt(&r);
+	int seed = saveReadInt(&r);
+	int galaxyRadius = saveReadInt(&r);
+	float resources[3];
+	saveRead(&r, resources, sizeof(resources));
+	float speedModifier = saveReadFloat(&r);
+	float leftoverStep = saveReadFloat(&r);
+	bool steplimiting = saveReadInt(&r) != 0;
+	Wave nextWave = loadWave(&r);
+	Wave currentWave = loadWave(&r);
+
+	arenaReset(&game.loadArena);
+	int numPlanets = saveReadCount(&r, SAVE_MAX_PLANETS);
+	saveReadFits(&r, numPlanets, SAVE_PLANET_BYTES);
+	Planet* planets = (Planet*) arenaAlloc(&game.loadArena, numPlanets * sizeof(Planet));
+	if (!planets)
+		r.failed = true;
+	for (int i = 0; i < numPlanets && !r.failed; i++)
+	{
+		Planet* p = &planets[i];
+		float x = saveReadFloat(&r);
+		float y = saveReadFloat(&r);
+		p->position = vecf(x, y);
+		p->radius = saveReadFloat(&r);
+		p->seed = saveReadInt(&r);
+		p->team = saveReadInt(&r);
+		saveRead(&r, p->shipPresence, sizeof(p->shipPresence));
+		p->numTiles = saveReadCount(&r, SAVE_MAX_TILES);
+		if (!saveReadFits(&r, p->numTiles, sizeof(Tile)))
+			break;
+		p->tiles = (Tile*) arenaAlloc(&game.loadArena, p->numTiles * sizeof(Tile));
+		if (!p->tiles)
+		{
+			r.failed = true;
+			break;
+		}
+		saveRead(&r, p->tiles, p->numTiles * sizeof(Tile));
+		for (int t = 0; t < p->numTiles; t++)
 		{
-			printf("Couldn't increase array size, aborting spawn.\n");
-			return NULL;
+			if (p->tiles[t].buildingType < 0 || p->tiles[t].buildingType >= num_buildings)
+				r.failed = true;
 		}
 	}
 
-	// printf("%d\n", game.ships);
+	// the columns are copied straight into a new store, which replaces the old one once everything checked out
+	ShipStore store;
+	memset(&store, 0, sizeof(ShipStore));
+	int num = saveReadCount(&r, SAVE_MAX_SHIPS);
+	int numSlots = saveReadCount(&r, SAVE_MAX_SHIPS);
+	int numFreeSlots = saveReadCount(&r, numSlots);
+	saveReadFits(&r, num, SAVE_SHIP_BYTES);
+	saveReadFits(&r, numSlots, sizeof(int)); // its generation
+	if (!r.failed && (num + numFreeSlots != numSlots || !shipStoreReserve(&store, max(numSlots, 1))))
+		r.failed = true;
+	if (!r.failed)
+	{
+		store.num = num;
+		store.numSlots = numSlots;
+		store.numFreeSlots = numFreeSlots;
+		saveRead(&r, store.x, num * sizeof(float));
+		saveRead(&r, store.y, num * sizeof(float));
+		saveRead(&r, store.vx, num * sizeof(float));
+		saveRead(&r, store.vy, num * sizeof(float));
+		saveRead(&r, store.fx, num * sizeof(float));
+		saveRead(&r, store.fy, num * sizeof(float));
+		saveRead(&r, store.health, num * sizeof(float));
+		saveRead(&r, store.weaponTimer, num * sizeof(float));
+		saveRead(&r, store.type, num * sizeof(int));
+		saveRead(&r, store.team, num * sizeof(int));
+		saveRead(&r, store.target, num * sizeof(ShipHandle));
+		saveRead(&r, store.slot, num * sizeof(int));
+		saveRead(&r, store.slotGeneration, numSlots * sizeof(int));
+		saveRead(&r, store.freeSlots, numFreeSlots * sizeof(int));
+	}
+	if (!r.failed)
+	{
+		// rebuild the slot index, every slot must belong to exactly one ship or be free
+		for (int i = 0; i < numSlots; i++)
+			store.slotIndex[i] = -1;
+		for (int i = 0; i < numFreeSlots; i++)
+		{
+			int slot = store.freeSlots[i];
+			if (slot < 0 || slot >= numSlots || store.slotIndex[slot] != -1)
+				r.failed = true;
+			else
+				store.slotIndex[slot] = -2;
+		}
+		for (int i = 0; i < num && !r.failed; i++)
+		{
+			int slot = store.slot[i];
+			if (slot < 0 || slot >= numSlots || store.slotIndex[slot] != -1
+				|| store.type[i] < 0 || store.type[i] >= 3 || store.team[i] < 0 || store.team[i] >= 2)
+				r.failed = true;
+			else
+				store.slotIndex[slot] = i;
+			store.damage[i] = 0.f;
+		}
+		for (int i = 0; i < numFreeSlots && !r.failed; i++)
+			store.slotIndex[store.freeSlots[i]] = -1;
+	}
+	if (!r.failed && r.pos != r.size)
+		r.failed = true;
+	closeSaveReader(&r);
 
-	Ship* s = &game.ships[game.numShips];
-	game.numShips++;
+	if (r.failed)
+	{
+		LOG_ERROR("Couldn't load %s, the file is damaged.\n", filename);
+		shipStoreFree(&store);
+		return false;
+	}
 
-	s->position = position;
-	s->velocity = vecf(0.f, 0.f);
-	s->type = type;
-	s->values = &game.shipClasses[type];
-	s->team = team;
-	s->health = s->values->baseHealth;
-	s->target = NULL;
-	s->weaponTimer = 0.f;
-	// printf("spawning ship #%d\n", game.numShips);
-	return s;
+	Arena arena = game.arena;
+	game.arena = game.loadArena;
+	game.loadArena = arena;
+	arenaReset(&game.loadArena);
+	shipStoreFree(&game.ships);
+	game.ships = store;
+	game.planets = planets;
+	game.numPlanets = numPlanets;
+	game.gameAge = gameAge;
+	game.tickCount = tickCount;
+	game.seed = seed;
+	game.galaxyRadius = galaxyRadius;
+	memcpy(game.resources, resources, sizeof(resources));
+	game.speedModifier = speedModifier;
+	game.leftoverStep = leftoverStep;
+	game.steplimiting = steplimiting;
+	game.nextWave = nextWave;
+	game.currentWave = currentWave;
+	game.presenceError = 0.f;
+	countBuildings();
+	scheduleShipyards();
+	buildPlanetGrid();
+
+	// the ships aren't the ones of the last snapshot anymore, and the popup may show a planet that is gone
+	for (int i = 0; i < game.snapshots.lenLast; i++)
+		game.snapshots.lastGeneration[i] = -1;
+	UIElement* planetPopup = uiElement("planetPopup");
+	if (planetPopup)
+		planetPopup->visible = false;
+	game.gui.dirty = true;
+
+	LOG_INFO("Loaded %d ships and %d planets from %s in %.2f ms\n", num, numPlanets, filename, (monotonicTime() - start) * 1000.0);
+	return true;
 }
 
-Texture* findTexture(char* name)
+Texture* findTexture(const char* name)
 {
 	for (int i = 0; i < game.numTextures; i++)
 	{
@@ -198,46 +720,87 @@ Texture* findTexture(char* name)
 	return NULL;
 }
 
-void buttonBuildingSelect(UIElement* source)
+InputEvent buttonBuildingSelect(UIElement* source)
 {
-	UIElement* buildingSelector = getElementByName(&game.gui, "buildingSelector");
-	buildingSelector->data = source->data;
+	InputEvent e = inputEvent(input_select_building);
+	e.building = source->data;
+	return e;
+}
+
+// builds the selected building on the tile of the planet in the popup
+InputEvent buttonTileClick(UIElement* source)
+{
+	InputEvent e = inputEvent(input_build);
+	e.planet = uiElement("planetPopup")->data;
+	e.tile = source->data;
+	e.building = uiElement("buildingSelector")->data;
+	return e;
+}
+
+void selectBuilding(int building)
+{
+	UIElement* buildingSelector = uiElement("buildingSelector");
+	buildingSelector->data = building;
 	for (int i = 0; i < buildingSelector->numChildren; i++)
 	{
 		buildingSelector->children[i].borderColor = vecf(0.f, 0.f, 0.f, 1.f);
 		// buildingSelector->children[i].faceColor = vecf(0.1f, 0.1f, 0.1f, 0.f);
+		if (buildingSelector->children[i].data == building)
+			buildingSelector->children[i].borderColor.z = 0.9;
 	}
-	source->borderColor.z = 0.9;
-	// source->faceColor.w = 1.f;
 }
 
-void buttonTileClick(UIElement* source)
+// shows the planet in the popup, or closes it for -1
+void selectPlanet(int planet)
 {
-	UIElement* buildingSelector = getElementByName(&game.gui, "buildingSelector");
-	UIElement* planetPopup = getElementByName(&game.gui, "planetPopup");
+	UIElement* planetPopup = uiElement("planetPopup");
+	planetPopup->visible = false;
+	if (planet < 0 || planet >= game.numPlanets)
+		return;
+	Planet* p = &game.planets[planet];
+	for (int j = 0; j < 20; j++)
+	{
+		if (j < p->numTiles)
+		{
+			planetPopup->children[j].texture = &game.textures[p->tiles[j].buildingType];
+			planetPopup->children[j].visible = true;
+		}
+		else
+			planetPopup->children[j].visible = false;
+	}
+	planetPopup->visible = true;
+	planetPopup->data = planet;
+}
 
-	if (game.resources[rsc_sbm] >= game.buildingPrices[buildingSelector->data])
+void build(int planet, int tile, int building)
+{
+	// replays come from files, so don't trust the numbers
+	if (planet < 0 || planet >= game.numPlanets || tile < 0 || tile >= game.planets[planet].numTiles
+		|| building < 0 || building >= num_buildings)
+		return;
+	if (game.resources[rsc_sbm] >= game.buildingPrices[building])
 	{
-		game.resources[rsc_sbm] -= game.buildingPrices[buildingSelector->data];
-		Planet* p = &game.planets[planetPopup->data];
+		game.resources[rsc_sbm] -= game.buildingPrices[building];
+		Planet* p = &game.planets[planet];
 		p->team = 0;
-		p->tiles[source->data].buildingType = buildingSelector->data;
-		source->texture = &game.textures[buildingSelector->data];
+		setBuilding(p, tile, building);
+		UIElement* planetPopup = uiElement("planetPopup");
+		if (planetPopup->data == planet && tile < 20)
+			planetPopup->children[tile].texture = &game.textures[building];
 	}
 }
 
 void createUI()
 {
+	pthread_mutex_init(&game.uiLock, NULL);
+
 	// root element fills the whole ui area
-	game.gui.position = vecf(0.f, 0.f);
-	game.gui.size = vecf(1.f, 1.f);
-	game.gui.visible = true;
-	game.gui.enabled = true;
+	UIElement* root = initUI(&game.gui);
 
-	UIElement* squareCenter = addChild(&game.gui);
+	UIElement* squareCenter = addChild(&game.gui, root);
 	strcpy(squareCenter->name, "squareCenter");
 
-	UIElement* planetPopup = addChild(squareCenter);
+	UIElement* planetPopup = addChild(&game.gui, squareCenter);
 	strcpy(planetPopup->name, "planetPopup");
 	planetPopup->position = vecf(0.1f, 0.1f);
 	planetPopup->size = vecf(0.8f, 0.8f);
@@ -248,7 +811,7 @@ void createUI()
 	// planet tiles
 	for (int i = 0; i < 20; i++)
 	{
-		UIElement* tile = addChild(planetPopup);
+		UIElement* tile = addChild(&game.gui, planetPopup);
 		int x = i % 5;
 		int y = i / 5;
 		tile->data = i;
@@ -260,7 +823,7 @@ void createUI()
 		tile->onClick = &buttonTileClick;
 	}
 
-	UIElement* buildingSelector = addChild(planetPopup);
+	UIElement* buildingSelector = addChild(&game.gui, planetPopup);
 	strcpy(buildingSelector->name, "buildingSelector");
 	buildingSelector->position = vecf(0.025f, 0.83f);
 	buildingSelector->size = vecf(0.95f, 0.15f);
@@ -269,7 +832,7 @@ void createUI()
 	// building selectors
 	for (int i = 2; i < 8; i++)
 	{
-		UIElement* tile = addChild(buildingSelector);
+		UIElement* tile = addChild(&game.gui, buildingSelector);
 		tile->data = i;
 		int x = i - 2;
 		tile->size = vecf(0.15f, 0.8f);
@@ -279,12 +842,18 @@ void createUI()
 		tile->texture = &game.textures[i];
 		tile->onClick = &buttonBuildingSelect;
 	}
+
+	buildUIIndex(&game.guiIndex, &game.gui);
+	game.affordableBuildings = -1; // none of the selectors were updated yet
 }
 
+#ifndef HEADLESS
 void resizeWindow(SDL_Event event)
 {
 	game.window_width = event.window.data1;
 	game.window_height = event.window.data2;
+	if (game.window_width == 0)
+		game.window_width = 1;
 	if (game.window_height == 0)
 		game.window_height = 1;
 	game.aspectRatio = (float) game.window_width / game.window_height;
@@ -293,47 +862,52 @@ void resizeWindow(SDL_Event event)
 	float xpadding = (float) (game.window_width - min(game.window_width, game.window_height)) / game.window_width;
 	float ypadding = (float) (game.window_height - min(game.window_width, game.window_height)) / game.window_height;
 
-	UIElement* squareCenter = getElementByName(&game.gui, "squareCenter");
+	UIElement* squareCenter = uiElement("squareCenter");
 	if (!squareCenter)
 	{
-		printf("Couldn't find squareCenter!\n");
+		LOG_ERROR("Couldn't find squareCenter!\n");
 		return;
 	}
 
-	//printf("1st name %s %s\n", game.gui.children[0].name, squareCenter->name);
+	//printf("1st name %s %s\n", uiRoot(&game.gui)->children[0].name, squareCenter->name);
 
 	squareCenter->position = vecf(xpadding / 2.f, ypadding / 2.f);
 	squareCenter->size = vecf(1.f - xpadding, 1.f - ypadding);
+	game.gui.pixelSize = vecf(1.f / game.window_width, 1.f / game.window_height);
+	game.gui.dirty = true;
 	//printf("%s %f %f - %f %f\n", squareCenter->name,
 	//	squareCenter->position.x, squareCenter->position.y, 
 	//	squareCenter->size.x, squareCenter->size.y);
 
-	printf("Window resized %d %d\n", game.window_width, game.window_height);
+	LOG_INFO("Window resized %d %d\n", game.window_width, game.window_height);
 }
+#endif
 
-void handleKeys( unsigned char key, int x, int y )
+// keys that change the game, called on the simulation thread
+void handleKeys( unsigned char key )
 {
 	if (key == SDL_SCANCODE_RIGHTBRACKET)
 	{
 		game.speedModifier *= 2.f;
 		if (game.speedModifier > 32.f)
 			game.speedModifier = 32.f;
-		printf("speedModifier is now %f\n", game.speedModifier);
+		LOG_INFO("speedModifier is now %f\n", game.speedModifier);
 	}
 	if (key == SDL_SCANCODE_LEFTBRACKET)
 	{
 		game.speedModifier /= 2.f;
-		printf("speedModifier is now %f\n", game.speedModifier);
+		LOG_INFO("speedModifier is now %f\n", game.speedModifier);
 	}
 	if (key == SDL_SCANCODE_S)
 	{
 		game.currentWave.shipsToSpawn[0] = 50;
 		game.currentWave.shipsToSpawn[1] = 50;
 		game.currentWave.shipsToSpawn[2] = 50;
+		reserveWave(&game.currentWave);
 	}
 	if (key == SDL_SCANCODE_D)
 	{
-		// for (int i = 0; i < game.numShips; ++i)
+		// for (int i = 0; i < game.ships.num; ++i)
 		// {
 		// 	if (game.ships[i].target != NULL)
 		// 	{
@@ -343,7 +917,7 @@ void handleKeys( unsigned char key, int x, int y )
 		// }
 		for (int i = 0; i < game.numPlanets; ++i)
 		{
-			printf("%d %f %f %f\n", game.planets[i].team, game.planets[i].shipPresence[0], game.planets[i].shipPresence[1], game.planets[i].shipPresence[2]);
+			LOG_INFO("%d %f %f %f\n", game.planets[i].team, game.planets[i].shipPresence[0], game.planets[i].shipPresence[1], game.planets[i].shipPresence[2]);
 		}
 	}
 	if (key == SDL_SCANCODE_SPACE)
@@ -352,64 +926,202 @@ void handleKeys( unsigned char key, int x, int y )
 	}
 	if (key == SDL_SCANCODE_ESCAPE)
 	{
-		UIElement* planetPopup = getElementByName(&game.gui, "planetPopup");
+		UIElement* planetPopup = uiElement("planetPopup");
 		planetPopup->visible = false;
 	}
 	if (key == SDL_SCANCODE_F5)
 	{
 		game.steplimiting = !game.steplimiting;
 	}
+	if (key == SDL_SCANCODE_F6)
+	{
+		saveGame("quicksave.oof");
+	}
+	if (key == SDL_SCANCODE_F9)
+	{
+		loadGame("quicksave.oof");
+	}
 }
 
-void handleMouseButtons(uint8_t button, int32_t x, int32_t y)
+#ifndef HEADLESS
+// keys that only change the view, called on the window thread
+void handleViewKeys( unsigned char key )
 {
-	float fx = (float) x / game.window_width;
-	float fy = (float) y / game.window_height;
-	//printf("%f %f\n", fx, fy);
-	UIElement* elem = getElementAt(&game.gui, fx, fy);
+	(void) key; // only the profiler has view keys so far
+#ifdef PROFILE
+	if (key == SDL_SCANCODE_F3)
+	{
+		toggleProfileOverlay();
+	}
+	if (key == SDL_SCANCODE_F4)
+	{
+		profileWriteTrace("trace.json");
+	}
+#endif
+}
+#endif
+
+// turns a click at window pixel (x, y) into an input event for the simulation
+InputEvent mouseEvent(uint8_t button, int32_t x, int32_t y)
+{
+	InputEvent e = inputEvent(input_mouse);
+	e.key = button;
+	e.ui = vecf((float) x / game.window_width, (float) y / game.window_height);
+	e.world.x = (e.ui.x - 0.5f) * 200 * game.aspectRatio / game.cameraZoom;
+	e.world.y = (e.ui.y - 0.5f) * -200 / game.cameraZoom;
+	return e;
+}
+
+// what a click does with the ui as it is now, see mouseEvent for its position
+InputEvent resolveClick(InputEvent click)
+{
+	//printf("%f %f\n", click.ui.x, click.ui.y);
+	UIElement* elem = getElementAt(uiRoot(&game.gui), click.ui.x, click.ui.y);
 	if (elem)
 	{
 		if (elem->onClick)
 		{
 			if (elem->enabled)
 			{
-				elem->onClick(elem);
+				return elem->onClick(elem);
 			}
-			return;
+			return inputEvent(input_none);
 		}
 	}
 
-	UIElement* planetPopup = getElementByName(&game.gui, "planetPopup");
-	planetPopup->visible = false;
-	fx -= 0.5f;
-	fy -= 0.5f;
-	fx *= 200 * game.aspectRatio / game.cameraZoom;
-	fy *= -200 / game.cameraZoom;
-	for (int i = 0; i < game.numPlanets; i++)
+	// the first planet under the cursor, or none to close the popup
+	Vectorf world = click.world;
+	int clicked = -1;
+	PlanetGridQuery query;
+	planetGridQueryBegin(&query, &game.planetGrid, world, game.planetGrid.maxRadius);
+	for (PlanetGridEntry* e = planetGridQueryNext(&query); e; e = planetGridQueryNext(&query))
 	{
-		//printf("%f %f - %f %f = %f?\n", fx, fy, game.planets[i].position.x, game.planets[i].position.y, game.planets[i].radius);
-		if (veclen(vecsub(game.planets[i].position, vecf(fx, fy))) <= game.planets[i].radius)
+		if ((clicked < 0 || e->index < clicked) && veclen(vecsub(game.planets[e->index].position, world)) <= game.planets[e->index].radius)
+			clicked = e->index;
+	}
+	InputEvent e = inputEvent(input_select_planet);
+	e.planet = clicked;
+	return e;
+}
+
+void applyInput(InputEvent e)
+{
+	if (e.type == input_key)
+		handleKeys(e.key);
+	else if (e.type == input_select_planet)
+		selectPlanet(e.planet);
+	else if (e.type == input_select_building)
+		selectBuilding(e.building);
+	else if (e.type == input_build)
+		build(e.planet, e.tile, e.building);
+}
+
+uint64_t gameChecksum();
+
+// where F7 records to, the starting state and the inputs
+const char* recordingStart = "recording.oof";
+const char* recordingInputs = "recording.inputs";
+
+// starts recording the inputs from the current state on, or stops the recording
+void toggleRecording()
+{
+	if (game.recorder.file)
+	{
+		LOG_INFO("Recorded %d frames to %s\n", game.recorder.frame, recordingInputs);
+		stopRecording(&game.recorder, gameChecksum());
+		return;
+	}
+	if (saveGame(recordingStart) && startRecording(&game.recorder, recordingInputs, SIM_TICK_RATE, recordingStart))
+		LOG_INFO("Recording inputs to %s\n", recordingInputs);
+}
+
+// applies the input events queued by the window thread
+void applyInputs()
+{
+	InputEvent events[INPUT_QUEUE_SIZE];
+	int num = takeInputs(&game.inputs, events);
+	if (num == 0)
+		return;
+	pthread_mutex_lock(&game.uiLock);
+	for (int i = 0; i < num; i++)
+	{
+		// the recording key itself isn't recorded, a replay would start another recording
+		if (events[i].type == input_key && events[i].key == SDL_SCANCODE_F7)
 		{
-			for (int j = 0; j < 20; j++)
-			{
-				if (j < game.planets[i].numTiles)
-				{
-					planetPopup->children[j].texture = &game.textures[game.planets[i].tiles[j].buildingType];
-					planetPopup->children[j].visible = true;
-				}
-				else
-					planetPopup->children[j].visible = false;
-			}
-			planetPopup->visible = true;
-			planetPopup->data = i;
-			break;
+			toggleRecording();
+			continue;
 		}
+		InputEvent e = events[i].type == input_mouse ? resolveClick(events[i]) : events[i];
+		recordInput(&game.recorder, e);
+		applyInput(e);
 	}
+	game.gui.dirty = true; // clicks and keys may have changed any element
+	pthread_mutex_unlock(&game.uiLock);
+}
+
+// ship classes and building prices, these don't change between games
+void initGameValues()
+{
+	ShipClass fighter;
+	fighter.acceleration = 0.5f;
+	fighter.speed = 5.f;
+	fighter.damageModifiers[0] = 50.f;
+	fighter.damageModifiers[1] = 100.f;
+	fighter.damageModifiers[2] = 5.f;
+	fighter.sensorRange = 15.f;
+	fighter.weaponRange = 7.5f;
+	fighter.fireSpeed = 10.f;
+	fighter.baseHealth = 100.f;
+	fighter.energyUsage = 0.01f;
+	fighter.buildCost = 0.2f;
+	game.shipClasses[0] = fighter;
+
+	ShipClass bomber;
+	bomber.acceleration = 0.1f;
+	bomber.speed = 3.f;
+	bomber.damageModifiers[0] = 5.f;
+	bomber.damageModifiers[1] = 50.f;
+	bomber.damageModifiers[2] = 100.f;
+	bomber.sensorRange = 30.f;
+	bomber.weaponRange = 7.5f;
+	bomber.fireSpeed = 1.f;
+	bomber.baseHealth = 100.f;
+	bomber.energyUsage = 0.02f;
+	bomber.buildCost = 1.f;
+	game.shipClasses[1] = bomber;
+
+	ShipClass cruiser;
+	cruiser.acceleration = 0.2f;
+	cruiser.speed = 2.f;
+	cruiser.damageModifiers[0] = 100.f;
+	cruiser.damageModifiers[1] = 100.f;
+	cruiser.damageModifiers[2] = 25.f;
+	cruiser.sensorRange = 50.f;
+	cruiser.weaponRange = 7.5f;
+	cruiser.fireSpeed = 0.5f;
+	cruiser.baseHealth = 1000.f;
+	cruiser.energyUsage = 0.5f;
+	cruiser.buildCost = 5.f;
+	game.shipClasses[2] = cruiser;
+
+	game.buildingPrices[0] = 0;
+	game.buildingPrices[1] = 0;
+	game.buildingPrices[2] = 100;
+	game.buildingPrices[3] = 100;
+	game.buildingPrices[4] = 100;
+	game.buildingPrices[5] = 250;
+	game.buildingPrices[6] = 500;
+	game.buildingPrices[7] = 1000;
+
+	game.targetMode = target_best;
+	game.presenceMode = presence_approx;
+	game.presenceMaxError = 0.01f;
+	game.spawnBudget = WAVE_SPAWN_BUDGET;
 }
 
 void newGame(int seed, float galaxyRadius, int planets)
 {
-	printf("Generating game using seed %d\n", seed);
+	LOG_INFO("Generating game using seed %d\n", seed);
 	// make sure no old data survives
 	clearGame();
 	
@@ -420,11 +1132,11 @@ void newGame(int seed, float galaxyRadius, int planets)
 	
 	// generate planets
 	// it is important to seed the planets individually first, so the seeds can be used without interference
-	srand(game.seed);
-	game.planets = (Planet*) malloc(sizeof(Planet) * planets);
+	game.planets = (Planet*) arenaAlloc(&game.arena, sizeof(Planet) * planets);
 	for (int i = 0; i < game.numPlanets; i++)
 	{
-		game.planets[i].seed = rand();
+		RandomStream rng = randomStream(game.seed, rng_planet_seed, i);
+		game.planets[i].seed = randomInt(&rng);
 	}
 
 	// actually generate planet values
@@ -434,16 +1146,16 @@ void newGame(int seed, float galaxyRadius, int planets)
 	{
 		Planet* planet = &game.planets[i];
 		planet->team = 1;
-		srand(game.planets[i].seed);
+		RandomStream rng = randomStream(game.planets[i].seed, rng_planet);
 		// positioning
 		planet->position = vecscale(vecf(cos(a), sin(a)), sqrt(r / game.galaxyRadius) * game.galaxyRadius);
 		r = r + game.galaxyRadius / game.numPlanets;
 		a = a + PI * (1 + r/game.galaxyRadius/game.numPlanets*2); // 2 arm spiral galaxy
-		printf("Planet seed: %d\n", planet->seed);
+		LOG_DEBUG("Planet seed: %d\n", planet->seed);
 		// size
-		planet->radius = (float) 5 + (rand() % 15);
+		planet->radius = (float) 5 + (randomInt(&rng) % 15);
 		planet->numTiles = round(planet->radius);
-		planet->tiles = (Tile*) malloc(sizeof(Tile) * planet->numTiles);
+		planet->tiles = (Tile*) arenaAlloc(&game.arena, sizeof(Tile) * planet->numTiles);
 		for (int t = 0; t < planet->numTiles; t++)
 		{
 			Tile* tile = &planet->tiles[t];
@@ -452,11 +1164,15 @@ void newGame(int seed, float galaxyRadius, int planets)
 		}
 	}
 
+	buildPlanetGrid();
+
 	// set up starting planet
 	Planet* p = &game.planets[0];
 	p->team = 0;
 	p->tiles[p->numTiles/2].buildingType = 1;
 	p->tiles[p->numTiles/2].buildingLevel = 1;
+	countBuildings();
+	scheduleShipyards();
 
 	game.nextWave.spawnAreaP1 = vecf(-galaxyRadius/10.f, galaxyRadius);
 	game.nextWave.spawnAreaP2 = vecf( galaxyRadius/10.f, galaxyRadius);
@@ -470,7 +1186,313 @@ void newGame(int seed, float galaxyRadius, int planets)
 	game.resources[rsc_sbm] = 450;
 	game.resources[rsc_food] = 300;
 
-	spawnShip(vecf(25.f,-25.f),0,0)->velocity=vecf(0.1,0.0);
+	setShipVelocity(spawnShip(vecf(25.f,-25.f),0,0), vecf(0.1,0.0));
+}
+
+// ship presence of the planets in [begin, end)
+void presenceJob(void*, int begin, int end)
+{
+	for (int i = begin; i < end; i++)
+	{
+		Planet* p = &game.planets[i];
+		p->shipPresence[0] = 0;
+		p->shipPresence[1] = 0;
+		p->shipPresence[2] = 0;
+		// sums min(1 / r, 1) per ship type
+		if (game.presenceMode == presence_approx)
+			presenceTreeSum(&game.presenceTree, p->position.x, p->position.y, game.presenceMaxError, p->shipPresence);
+		else
+			batchInverseDistanceSum(game.ships.x, game.ships.y, game.ships.type, game.ships.num,
+				p->position.x, p->position.y, p->shipPresence, 3);
+	}
+}
+
+// cruising ships look for enemies within sensor range, only writes the targets of [begin, end)
+void acquireTargetsJob(void*, int begin, int end)
+{
+	for (int i = begin; i < end; i++)
+	{
+		if (resolveShip(game.ships.target[i]) >= 0)
+			continue;
+		// every ship only looks once every few ticks, spread by handle slot since that doesn't change
+		if ((game.ships.slot[i] + game.tickCount) % TARGET_SCAN_INTERVAL != 0)
+			continue;
+		ShipClass* values = shipClass(i);
+		Vectorf position = shipPosition(i);
+
+		int best = -1;
+		float bestModifier = 0.f;
+		float bestDistance = 0.f;
+		GridQuery query;
+		gridQueryBegin(&query, &game.shipGrid, position, values->sensorRange, 1 - game.ships.team[i]);
+		for (int j = gridQueryNext(&query); j >= 0; j = gridQueryNext(&query))
+		{
+			float r = veclen(vecsub(position, shipPosition(j)));
+			if (r >= values->sensorRange)
+				continue;
+			float modifier = game.targetMode == target_best ? values->damageModifiers[game.ships.type[j]] : 0.f;
+			if (best < 0 || modifier > bestModifier || (modifier == bestModifier && r < bestDistance))
+			{
+				best = j;
+				bestModifier = modifier;
+				bestDistance = r;
+			}
+		}
+		if (best >= 0)
+			game.ships.target[i] = shipHandle(best);
+	}
+}
+
+// bounds the planet grid uses to skip cells in bestPlanet, the presence of
+// every ship type at the planets of team 0, after the presence changed
+void updatePlanetRanks()
+{
+	if (!game.planetRanks)
+		return;
+	for (int i = 0; i < game.numPlanets; i++)
+	{
+		for (int t = 0; t < PLANET_GRID_GROUPS; t++)
+			game.planetRanks[i * PLANET_GRID_GROUPS + t] = game.planets[i].team == 0 ? game.planets[i].shipPresence[t] : -1.f;
+	}
+	planetGridUpdateBounds(&game.planetGrid, game.planetRanks);
+}
+
+// how much a ship at position is drawn to planet j, lower is better
+inline float planetFactor(int j, Vectorf position, int type)
+{
+	float r = veclen(vecsub(game.planets[j].position, position));
+	if (game.planets[j].team == 0)
+		return sqrt(sqrt(r)) * game.planets[j].shipPresence[type];
+	return r * 1000;
+}
+
+inline void considerPlanet(int j, float f, int* best, float* bestFactor)
+{
+	// the lowest index wins ties, like when ranking the planets in order
+	if (f < *bestFactor || (f == *bestFactor && j < *best))
+	{
+		*best = j;
+		*bestFactor = f;
+	}
+}
+
+// the planet a cruising ship heads for, the one with the lowest planetFactor
+// below 10000, or -1 if there is none. Only planets of team 0 can be that far
+// away, the others have to be within 10. Team 0 planets are searched ring by
+// ring of grid cells around the ship, and cells whose lowest possible factor
+// can't beat the best planet so far are skipped, see updatePlanetRanks.
+int bestPlanet(Vectorf position, int type)
+{
+	PlanetGrid* g = &game.planetGrid;
+	int best = -1;
+	float bestFactor = 10000.f;
+	PlanetGridQuery query;
+	planetGridQueryBegin(&query, g, position, 10.f);
+	for (PlanetGridEntry* e = planetGridQueryNext(&query); e; e = planetGridQueryNext(&query))
+	{
+		if (game.planets[e->index].team != 0)
+			considerPlanet(e->index, planetFactor(e->index, position, type), &best, &bestFactor);
+	}
+
+	float minPresence = g->minBound[type];
+	if (minPresence < 0.f || g->cols == 0)
+		return best;
+	int px = (int) floorf((position.x - g->originX) / g->cellSize);
+	int py = (int) floorf((position.y - g->originY) / g->cellSize);
+	// rings before the first one touching the grid are empty
+	int k0 = max(max(-px, px - (g->cols - 1)), max(-py, py - (g->rows - 1)));
+	int k1 = max(max(px, g->cols - 1 - px), max(py, g->rows - 1 - py));
+	for (int k = max(k0, 0); k <= k1; k++)
+	{
+		// every cell of ring k is at least k - 1 cells away
+		float ringDistance = max((k - 1) * g->cellSize * 0.999f, 0.f);
+		if (sqrt(sqrt(ringDistance)) * minPresence > bestFactor)
+			break;
+		for (int cy = max(py - k, 0); cy <= min(py + k, g->rows - 1); cy++)
+		{
+			// the top and bottom rows of the ring are whole, the others only have their ends
+			int step = cy == py - k || cy == py + k ? 1 : 2 * k;
+			for (int cx = px - k; cx <= px + k; cx += step)
+			{
+				if (cx < 0 || cx >= g->cols)
+					continue;
+				int c = cy * g->cols + cx;
+				float presence = g->bound[c * PLANET_GRID_GROUPS + type];
+				if (presence < 0.f || sqrt(sqrt(planetGridCellDistance(g, cx, cy, position))) * presence > bestFactor)
+					continue;
+				for (int e = g->cellStart[c]; e < g->cellStart[c + 1]; e++)
+				{
+					int j = g->entries[e].index;
+					if (game.planets[j].team == 0)
+						considerPlanet(j, planetFactor(j, position, type), &best, &bestFactor);
+				}
+			}
+		}
+	}
+	return best;
+}
+
+#define PLANET_EVASION_MAX 64
+
+// pushes ships out of the planets they get too close to
+Vectorf planetEvasion(Vectorf position)
+{
+	// the forces are added in planet order, in galaxies so dense that more
+	// planets are near than fit, all planets are checked in order instead
+	int near[PLANET_EVASION_MAX];
+	int numNear = 0;
+	bool overflow = false;
+	PlanetGridQuery query;
+	planetGridQueryBegin(&query, &game.planetGrid, position, game.planetGrid.maxRadius * 1.1f);
+	for (PlanetGridEntry* e = planetGridQueryNext(&query); e; e = planetGridQueryNext(&query))
+	{
+		if (veclen(vecsub(game.planets[e->index].position, position)) < game.planets[e->index].radius * 1.1f)
+		{
+			if (numNear == PLANET_EVASION_MAX)
+			{
+				overflow = true;
+				break;
+			}
+			int k = numNear++;
+			for (; k > 0 && near[k - 1] > e->index; k--)
+				near[k] = near[k - 1];
+			near[k] = e->index;
+		}
+	}
+
+	Vectorf force = vecf(0.f, 0.f);
+	int num = overflow ? game.numPlanets : numNear;
+	for (int k = 0; k < num; k++)
+	{
+		Planet* planet = &game.planets[overflow ? k : near[k]];
+		float r = veclen(vecsub(planet->position, position));
+		if (r < planet->radius * 1.1f)
+		{
+			force = vecadd(force, vecscale(normalize(vecsub(position, planet->position)), 
+				max(min(2.f * planet->radius - r, 10), 0)));
+		}
+	}
+	return force;
+}
+
+// flocking and fighting, only writes force, weapon timer, damage and target of [begin, end)
+void shipForcesJob(void* data, int begin, int end)
+{
+	float step = *(float*) data;
+	for (int i = begin; i < end; i++)
+	{
+		ShipClass* values = shipClass(i);
+		Vectorf position = shipPosition(i);
+		Vectorf velocity = shipVelocity(i);
+		int team = game.ships.team[i];
+		Vectorf force;
+		force = vecf(0.f, 0.f);
+		game.ships.damage[i] = 0.f;
+		int target = resolveShip(game.ships.target[i]);
+		if (target < 0) // cruise mode
+		{
+			game.ships.target[i] = noShip;
+			Vectorf planetAttraction = vecf(0.f, 0.f);
+			int best = bestPlanet(position, game.ships.type[i]);
+			if (best >= 0)
+				planetAttraction = normalize(vecsub(game.planets[best].position, position));
+			force = planetEvasion(position);
+
+			Vectorf positionSum = vecf(0.f, 0.f);
+			int numPeers = 0;
+			GridQuery query;
+			gridQueryBegin(&query, &game.shipGrid, position, 5.f, team);
+			for (int j = gridQueryNext(&query); j >= 0; j = gridQueryNext(&query))
+			{
+				Vectorf peerPosition = shipPosition(j);
+				float r = veclen(vecsub(position, peerPosition));
+
+				// seperation
+				if (r < 5.f)
+				{
+					force = vecadd(force, normalize(vecsub(position, peerPosition)));
+				}
+
+				// alignment
+				if (r < 2.f)
+				{
+					force = vecadd(force, vecscale(normalize(vecsub(shipVelocity(j), velocity)), 2.f));
+				}
+
+				// cohesion pt. 1
+				if (r < 5.f)
+				{
+					numPeers++;
+					positionSum = vecadd(positionSum, peerPosition);
+				}
+			}
+			// cohesion pt. 2
+			if (numPeers > 0)
+				force = vecadd(force, vecscale(normalize(vecsub(vecscale(positionSum, 1.f/numPeers), position)), 0.5f));
+
+			force = vecadd(force, vecscale(normalize(planetAttraction), 3.f));
+		} else { // target mode
+			// continue;
+			Vectorf relpos = vecsub(shipPosition(target), position);
+
+			float r = veclen(relpos);
+			if (r < values->weaponRange)
+			{
+				// weapon animation
+				game.ships.weaponTimer[i] += step * values->fireSpeed;
+				if (game.ships.weaponTimer[i] > 1000.f)
+					game.ships.weaponTimer[i] = 0.f;
+				// impart damage, other ships may shoot at the same target so this is applied later
+				game.ships.damage[i] = step * values->damageModifiers[game.ships.type[target]];
+			}
+			if (r > values->weaponRange)
+			{
+				game.ships.target[i] = noShip;
+			}
+			force = vecadd(force, normalize(relpos));
+		}
+
+		setShipForce(i, force); // also used for debugging during the render cycle
+	}
+}
+
+// moves the ships in [begin, end) according to their forces
+void integrateShipsJob(void* data, int begin, int end)
+{
+	float step = *(float*) data;
+	ShipStore* ships = &game.ships;
+	int n = end - begin;
+	for (int i = begin; i < end; i++)
+	{
+		ships->scratch[i] = step * shipClass(i)->acceleration;
+	}
+	batchScaleAdd(ships->vx + begin, ships->vy + begin, ships->fx + begin, ships->fy + begin, ships->scratch + begin, n);
+	batchNormalize(ships->vx + begin, ships->vy + begin, n);
+	// normalize velocity and adjust it as per type
+	for (int i = begin; i < end; i++)
+	{
+		ships->scratch[i] = step * shipClass(i)->speed;
+	}
+	batchScaleAdd(ships->x + begin, ships->y + begin, ships->vx + begin, ships->vy + begin, ships->scratch + begin, n);
+}
+
+// the production of shipyard tile j of planet i that was due at the given second
+void produceShip(int i, int j, int time)
+{
+	Planet* p = &game.planets[i];
+	int type = p->tiles[j].buildingType - first_shipyard;
+	// deactivated if there's not enough energy, and only while the planet lacks ships of the type
+	if (game.resources[rsc_energy] <= 0 || p->shipPresence[type] >= p->radius)
+		return;
+	if (game.resources[rsc_sbm] < game.shipClasses[type].buildCost)
+		return;
+	game.resources[rsc_sbm] -= game.shipClasses[type].buildCost;
+	RandomStream r = randomStream(game.seed, rng_shipyard, (uint64_t) i << 32 | j, time);
+	float a = (randomInt(&r) % 360) / (180.f/3.41f);
+	int s = spawnShip(vecadd(vecf(cos(a)*p->radius, sin(a)* p->radius), p->position), type, 0);
+	if (s < 0)
+		return;
+	setShipVelocity(s, normalize(vecadd(vecsub(shipPosition(s), p->position), randomBetween(&r, vecf(-0.1f, -0.1f), vecf(0.1f, 0.1f)))));
 }
 
 void tickGame(float step, bool fixedStepSize = false, float stepsize = 0.016f) // 1/0.016 = 60 fps
@@ -486,7 +1508,7 @@ void tickGame(float step, bool fixedStepSize = false, float stepsize = 0.016f) /
 		step += game.leftoverStep;
 		if (step/stepsize > 5.f) // don't do more than 5 steps per frame
 		{
-			printf("Overstepping! Dropping some steps!\n");
+			LOG_INFO("Overstepping! Dropping some steps!\n");
 			step = stepsize * 5.f;
 		}
 		while (step >= stepsize)
@@ -497,35 +1519,32 @@ void tickGame(float step, bool fixedStepSize = false, float stepsize = 0.016f) /
 		game.leftoverStep = step;
 		return;
 	}
+	PROFILE_ZONE("tick");
+	game.tickCount++;
+	double phaseStart = monotonicTime();
 
 	// "remove" dead ships(and count ships)
 	int enemy_shipcount = 0;
 	int player_shipcount = 0;
-	for (int i = game.numShips; i >= 0; i--)
+	for (int i = game.ships.num - 1; i >= 0; i--)
 	{
-		if (game.ships[i].health < 0.f)
+		if (game.ships.health[i] < 0.f)
 		{
-			for (int j = 0; j < game.numShips; j++)
-			{
-				if (game.ships[j].target == &game.ships[i])
-				{
-					game.ships[j].target = NULL;
-				}
-			}
-			game.ships[i] = game.ships[game.numShips - 1];
-			game.ships[i].target = NULL;
-			game.numShips--;
+			// handles aimed at this ship stop resolving, no need to look for them
+			shipStoreRemove(&game.ships, i);
 		} else {
-			if (game.ships[i].team == 1)
+			if (game.ships.team[i] == 1)
 				enemy_shipcount++;
-			if (game.ships[i].team == 0)
+			if (game.ships.team[i] == 0)
 				player_shipcount++;
 		}
 	}
 
+	endPhase(phase_cleanup, &phaseStart);
+
 	if (player_shipcount == 0)
 	{
-		printf("\n\n\n==================\n\nYou lost to wave number %d...\n\n==================\n\n\n\n", game.currentWave.waveNumber + 1);
+		LOG_INFO("\n\n\n==================\n\nYou lost to wave number %d...\n\n==================\n\n\n\n", game.currentWave.waveNumber + 1);
 		game.speedModifier = 0.f;
 	}
 
@@ -533,6 +1552,7 @@ void tickGame(float step, bool fixedStepSize = false, float stepsize = 0.016f) /
 	if (enemy_shipcount == 0 && game.currentWave.countdown < 0.f)
 	{
 		game.currentWave = game.nextWave;
+		reserveWave(&game.currentWave);
 		game.nextWave.waveNumber++;
 		for (int i = 0; i < 3; ++i)
 		{
@@ -540,106 +1560,44 @@ void tickGame(float step, bool fixedStepSize = false, float stepsize = 0.016f) /
 		}
 	}
 
-	// tick wave
+	// tick wave, the ships come in one block per type, up to spawnBudget
+	// ships per frame so a big wave can't stall it, however many ticks the
+	// frame takes. Its room was reserved when it started.
 	game.currentWave.countdown -= step;
 	if (game.currentWave.countdown < 0.f)
 	{
-		for (int i = 0; i < 3; i++)
+		for (int i = 0; i < 3 && game.spawnBudgetLeft > 0; i++)
 		{
-			if (game.currentWave.shipsToSpawn[i] > 0)
-			{
-				game.currentWave.shipsToSpawn[i] -= 1;
-				Ship* s = spawnShip(randomBetween(game.currentWave.spawnAreaP1, game.currentWave.spawnAreaP2), i, 1);
-				// printf("%f %f\n", s->position.x, s->position.y);
-			}
+			if (game.currentWave.shipsToSpawn[i] <= 0)
+				continue;
+			int count = min(game.spawnBudgetLeft, (int) ceilf(game.currentWave.shipsToSpawn[i]));
+			game.currentWave.shipsToSpawn[i] -= count;
+			RandomStream r = randomStream(game.seed, rng_wave, i, game.tickCount);
+			spawnShips(count, i, 1, &r, game.currentWave.spawnAreaP1, game.currentWave.spawnAreaP2);
+			game.spawnBudgetLeft -= count;
 		}
 	}
 
+	endPhase(phase_waves, &phaseStart);
+
 	Vectorf resource_delta = vecf(0, 0, 0);
 
 	// tick planets
-	bool tick = false; // this is only true during one cycle per second and used to determine when to spawn ships
-	if ((int)game.gameAge != (int)(game.gameAge+step))
-	{
-		tick = true;
-		//printf("tick! %d %d %f\n", (int)game.gameAge, (int)(game.gameAge+step), game.gameAge+step);
-	}
-	for (int i = 0; i < game.numPlanets; i++)
+	resource_delta = buildingProduction();
+
+	// shipyards whose production second the game age passes in this step, a
+	// large step catches up on every second it passes
+	int now = (int)(game.gameAge + step);
+	ScheduledEvent e;
+	while (schedulePop(&game.shipyards, now, &e))
 	{
-		for (int j = 0; j < game.planets[i].numTiles; j++)
-		{
-			switch (game.planets[i].tiles[j].buildingType)
-			{
-				case 0: // ignore, empty tile
-					break;
-				case 1: // HQ
-					resource_delta.x += 3;
-					resource_delta.y += 3;
-					resource_delta.z += 3;
-					break;
-				case 2: // mine
-					// deactivate building if there's not enough energy and its not producing energy
-					if (game.resources[rsc_energy] <= 0)
-							continue;
-					resource_delta.y += 3;
-					resource_delta.x -= 2;
-					break;
-				case 3: // power plant
-					resource_delta.x += 3;
-					break;
-				case 4: // farm
-					// deactivate building if there's not enough energy and its not producing energy
-					if (game.resources[rsc_energy] <= 0)
-							continue;
-					resource_delta.z += 3;
-					resource_delta.x -= 1;
-					break;
-				case 5: // shipyard(fighter), produces 1 ship every 5 seconds
-					// deactivate building if there's not enough energy and its not producing energy
-					if (game.resources[rsc_energy] <= 0)
-							continue;
-					if (tick && ((int)game.gameAge) % 2 == 0 && game.planets[i].shipPresence[0] < game.planets[i].radius)
-					{
-						if (game.resources[rsc_sbm] < game.shipClasses[0].buildCost)
-							break;
-						game.resources[rsc_sbm] -= game.shipClasses[0].buildCost;
-						float a = (rand() % 360) / (180.f/3.41f);
-						Ship* s = spawnShip(vecadd(vecf(cos(a)*game.planets[i].radius, sin(a)* game.planets[i].radius), game.planets[i].position), 0, 0);
-						s->velocity = normalize(vecadd(vecsub(s->position, game.planets[i].position), randomBetween(vecf(-0.1f, -0.1f), vecf(0.1f, 0.1f))));
-					}
-					break;
-				case 6: // shipyard(bomber), produces 1 ship every 15 seconds
-					// deactivate building if there's not enough energy and its not producing energy
-					if (game.resources[rsc_energy] <= 0)
-							continue;
-					if (tick && ((int)game.gameAge) % 10 == 0 && game.planets[i].shipPresence[1] < game.planets[i].radius)
-					{
-						if (game.resources[rsc_sbm] < game.shipClasses[1].buildCost)
-							break;
-						game.resources[rsc_sbm] -= game.shipClasses[1].buildCost;
-						float a = (rand() % 360) / (180.f/3.41f);
-						Ship* s = spawnShip(vecadd(vecf(cos(a)*game.planets[i].radius, sin(a)* game.planets[i].radius), game.planets[i].position), 1, 0);
-						s->velocity = normalize(vecadd(vecsub(s->position, game.planets[i].position), randomBetween(vecf(-0.1f, -0.1f), vecf(0.1f, 0.1f))));
-					}
-					break;
-				case 7: // shipyard(cruiser), produces 1 ship every 60 seconds
-					// deactivate building if there's not enough energy and its not producing energy
-					if (game.resources[rsc_energy] <= 0)
-							continue;
-					if (tick && ((int)game.gameAge) % 30 == 0 && game.planets[i].shipPresence[2] < game.planets[i].radius)
-					{
-						if (game.resources[rsc_sbm] < game.shipClasses[2].buildCost)
-							break;
-						game.resources[rsc_sbm] -= game.shipClasses[2].buildCost;
-						float a = (rand() % 360) / (180.f/3.41f);
-						Ship* s = spawnShip(vecadd(vecf(cos(a)*game.planets[i].radius, sin(a)* game.planets[i].radius), game.planets[i].position), 2, 0);
-						s->velocity = normalize(vecadd(vecsub(s->position, game.planets[i].position), randomBetween(vecf(-0.1f, -0.1f), vecf(0.1f, 0.1f))));
-					}
-					break;
-			}
-		}
+		produceShip(e.planet, e.tile, e.time);
+		int type = game.planets[e.planet].tiles[e.tile].buildingType;
+		schedulePush(&game.shipyards, e.time + shipyardPeriods[type - first_shipyard], e.planet, e.tile);
 	}
 
+	endPhase(phase_planets, &phaseStart);
+
 	// advance timers and process production values
 	game.gameAge += step;
 
@@ -648,6 +1606,26 @@ void tickGame(float step, bool fixedStepSize = false, float stepsize = 0.016f) /
 	presenceSum[0] = 0;
 	presenceSum[1] = 0;
 	presenceSum[2] = 0;
+	if (game.presenceMode != presence_exact)
+		presenceTreeBuild(&game.presenceTree, game.ships.x, game.ships.y, game.ships.type, game.ships.num);
+	parallelFor(game.numPlanets, 4, presenceJob, NULL);
+	if (game.presenceMode == presence_compare)
+	{
+		game.presenceError = 0.f;
+		for (int i = 0; i < game.numPlanets; i++)
+		{
+			Planet* p = &game.planets[i];
+			float approx[3] = {0.f, 0.f, 0.f};
+			presenceTreeSum(&game.presenceTree, p->position.x, p->position.y, game.presenceMaxError, approx);
+			for (int t = 0; t < 3; t++)
+			{
+				if (p->shipPresence[t] > 0.f)
+					game.presenceError = max(game.presenceError, fabsf(approx[t] - p->shipPresence[t]) / p->shipPresence[t]);
+			}
+		}
+		if (game.presenceError > game.presenceMaxError)
+			LOG_DEBUG("Presence error %f exceeds %f\n", game.presenceError, game.presenceMaxError);
+	}
 	for (int i = 0; i < game.numPlanets; i++)
 	{
 		Planet* p = &(game.planets[i]);
@@ -655,169 +1633,260 @@ void tickGame(float step, bool fixedStepSize = false, float stepsize = 0.016f) /
 		{
 			resource_delta.z -= sqrt(p->radius); // subtract some food
 		}
-		p->shipPresence[0] = 0;
-		p->shipPresence[1] = 0;
-		p->shipPresence[2] = 0;
-		for (int s = 0; s < game.numShips; s++)
-		{
-			// if (game.ships[s].team != p->team) continue;
-			float r = veclen(vecsub(game.ships[s].position, p->position));
-			if (r > 0.f)
-				p->shipPresence[game.ships[s].type] += min(1.f / r, 1.f);
-		}
 		presenceSum[0] += p->shipPresence[0];
 		presenceSum[1] += p->shipPresence[1];
 		presenceSum[2] += p->shipPresence[2];
 	}
+	updatePlanetRanks();
+	endPhase(phase_presence, &phaseStart);
 
-	// move ships
-	for (int i = 0; i < game.numShips; i++)
+	// index ship positions so flocking and sensors only look at nearby ships
+	gridBegin(&game.shipGrid, SHIP_GRID_CELL_SIZE, game.ships.num);
+	for (int i = 0; i < game.ships.num; i++)
 	{
-		Ship* s = &game.ships[i];
-		if (s->team == 0)
-			resource_delta.x -= s->values->energyUsage; // subtract some energy
-		Vectorf force;
-		force = vecf(0.f, 0.f);
-		if (s->target == NULL) // cruise mode
+		gridInsert(&game.shipGrid, i, shipPosition(i), game.ships.team[i]);
+	}
+	gridFinish(&game.shipGrid);
+	endPhase(phase_grid, &phaseStart);
+
+	// the ship phases below only read the state from before the phase and write to
+	// the ships they were given, so they can run on any number of threads
+	parallelFor(game.ships.num, SHIP_CHUNK_SIZE, acquireTargetsJob, NULL);
+	endPhase(phase_targets, &phaseStart);
+	parallelFor(game.ships.num, SHIP_CHUNK_SIZE, shipForcesJob, &step);
+	endPhase(phase_forces, &phaseStart);
+
+	// apply damage and energy usage in ship order
+	for (int i = 0; i < game.ships.num; i++)
+	{
+		if (game.ships.team[i] == 0)
+			resource_delta.x -= shipClass(i)->energyUsage; // subtract some energy
+		int target = resolveShip(game.ships.target[i]);
+		if (target >= 0)
 		{
-			Vectorf planetAttraction = vecf(0.f, 0.f);
-			Planet bestPlanet;
-			float bestFactor = 10000.f;
-			for (int j = 0; j < game.numPlanets; j++)
-			{
-				float r = veclen(vecsub(game.planets[j].position, s->position));
-				float f;
-				if (game.planets[j].team == 0)
-				{
-					f = sqrt(sqrt(r)) * game.planets[j].shipPresence[s->type];
-				} else {
-					f = r * 1000;
-				}
-				if (f < bestFactor)
-				{
-					bestPlanet = game.planets[j];
-					bestFactor = f;
-				}
+			game.ships.health[target] -= game.ships.damage[i];
+			if (game.ships.health[target] <= 0.f)
+				game.ships.target[i] = noShip;
+		}
+	}
+	endPhase(phase_damage, &phaseStart);
 
-				// planet evasion
-				if (r < game.planets[j].radius * 1.1f)
-				{
-					force = vecadd(force, vecscale(normalize(vecsub(s->position, game.planets[j].position)), 
-						max(min(2.f * game.planets[j].radius - r, 10), 0)));
-				}
-			}
-			planetAttraction = normalize(vecsub(bestPlanet.position, s->position));
+	// integrate all ships at once, forces above were computed from the positions before moving
+	parallelFor(game.ships.num, SHIP_CHUNK_SIZE, integrateShipsJob, &step);
+	endPhase(phase_integrate, &phaseStart);
 
-			Vectorf positionSum = vecf(0.f, 0.f);
-			int numPeers;
-			for (int j = 0; j < game.numShips; j++)
-			{
-				float r = veclen(vecsub(s->position, game.ships[j].position));
-				if (s->team != game.ships[j].team)
-				{
-					if (r < s->values->sensorRange)
-					{
-						if (random() % 100 > 90)
-						{
-							s->target = &game.ships[j];
-							break;
-						}
-					}
-					continue;
-				}
-
-				// seperation
-				if (r < 5.f)
-				{
-					force = vecadd(force, normalize(vecsub(s->position, game.ships[j].position)));
-				}
+	Vectorf resource_delta_scaled = vecscale(resource_delta, step); // make sure to advance the counters only by a fraction based on the time passeds
 
-				// alignment
-				if (r < 2.f)
-				{
-					force = vecadd(force, vecscale(normalize(vecsub(game.ships[j].velocity, s->velocity)), 2.f));
-				}
+	game.resources[rsc_energy] += resource_delta_scaled.x;
+	game.resources[rsc_sbm] += resource_delta_scaled.y;
+	game.resources[rsc_food] += resource_delta_scaled.z;
 
-				// cohesion pt. 1
-				if (r < 5.f)
-				{
-					numPeers++;
-					positionSum = vecadd(positionSum, game.ships[j].position);
-				}
+	// update building selectors to reflect whether they can be purchased with the current amount of funds,
+	// only when a price threshold was crossed since the last update
+	int affordable = 0;
+	for (int i = 0; i < 8; i++)
+	{
+		if (game.resources[rsc_sbm] >= game.buildingPrices[i])
+			affordable |= 1 << i;
+	}
+	if (affordable != game.affordableBuildings)
+	{
+		pthread_mutex_lock(&game.uiLock);
+		UIElement* buildingSelector = uiElement("buildingSelector");
+		for (int i = 0; i < buildingSelector->numChildren; i++)
+		{
+			UIElement* elem = &buildingSelector->children[i];
+			if (affordable & (1 << elem->data))
+			{
+				elem->enabled = true;
+				elem->faceColor = vecf(1.f, 1.f, 1.f, 1.f);
+			} else {
+				elem->enabled = false;
+				elem->faceColor = vecf(0.5f, 0.5f, 0.5f, 1.f);
 			}
-			// cohesion pt. 2
-			if (numPeers > 0)
-				force = vecadd(force, vecscale(normalize(vecsub(vecscale(positionSum, 1.f/numPeers), s->position)), 0.5f));
+		}
+		game.affordableBuildings = affordable;
+		game.gui.dirty = true;
+		pthread_mutex_unlock(&game.uiLock);
+	}
 
-			force = vecadd(force, vecscale(normalize(planetAttraction), 3.f));
-		} else { // target mode
-			// continue;
-			Vectorf relpos = vecsub(s->target->position, s->position);
+	LOG_DEBUG("Resources: %f %f %f, delta %f %f %f\n", game.resources[0], game.resources[1], game.resources[2], resource_delta.x, resource_delta.y, resource_delta.z);
+	endPhase(phase_ui, &phaseStart);
+}
 
-			float r = veclen(relpos);
-			if (r < s->values->weaponRange)
-			{
-				// weapon animation
-				s->weaponTimer += step * s->values->fireSpeed;
-				if (s->weaponTimer > 1000.f)
-					s->weaponTimer = 0.f;
-				// impart damage
-				s->target->health -= step * s->values->damageModifiers[s->target->type];
-			}
-			if (r > s->values->weaponRange || s->target->health <= 0.f)
-			{
-				s->target = NULL;
-			}
-			force = vecadd(force, normalize(relpos));
+// one step of the simulation loop, the same inputs and intervals starting
+// from the same state always end in the same state
+void simulateFrame(float interval)
+{
+	applyInputs();
+	game.spawnBudgetLeft = game.spawnBudget;
+	tickGame(interval, game.steplimiting);
+	recordFrame(&game.recorder);
+}
+
+// FNV-1a over the simulation state, equal checksums mean the runs didn't drift apart
+uint64_t gameChecksum()
+{
+	uint64_t hash = 14695981039346656037ull;
+	#define CHECKSUM(ptr, size) \
+		for (size_t b = 0; b < (size_t) (size); b++) \
+		{ \
+			hash ^= ((const unsigned char*) (ptr))[b]; \
+			hash *= 1099511628211ull; \
 		}
 
-		s->force = force; // copy for debugging during the render cycle
-		s->velocity = normalize(vecadd(s->velocity, vecscale(force, step * s->values->acceleration)));
-		// normalize velocity and adjust it as per type
-		s->position = vecadd(s->position, vecscale(s->velocity, step * s->values->speed));
+	CHECKSUM(&game.gameAge, sizeof(float));
+	CHECKSUM(&game.tickCount, sizeof(int));
+	CHECKSUM(game.resources, sizeof(game.resources));
+	CHECKSUM(&game.ships.num, sizeof(int));
+	CHECKSUM(game.ships.x, game.ships.num * sizeof(float));
+	CHECKSUM(game.ships.y, game.ships.num * sizeof(float));
+	CHECKSUM(game.ships.vx, game.ships.num * sizeof(float));
+	CHECKSUM(game.ships.vy, game.ships.num * sizeof(float));
+	CHECKSUM(game.ships.health, game.ships.num * sizeof(float));
+	CHECKSUM(game.ships.type, game.ships.num * sizeof(int));
+	CHECKSUM(game.ships.team, game.ships.num * sizeof(int));
+	for (int i = 0; i < game.numPlanets; i++)
+	{
+		CHECKSUM(&game.planets[i].team, sizeof(int));
+		CHECKSUM(game.planets[i].shipPresence, sizeof(game.planets[i].shipPresence));
+		for (int t = 0; t < game.planets[i].numTiles; t++)
+			CHECKSUM(&game.planets[i].tiles[t].buildingType, sizeof(int));
 	}
+	#undef CHECKSUM
+	return hash;
+}
 
-	Vectorf resource_delta_scaled = vecscale(resource_delta, step); // make sure to advance the counters only by a fraction based on the time passeds
+#define ASSET_PACK "assets.pack"
 
-	game.resources[rsc_energy] += resource_delta_scaled.x;
-	game.resources[rsc_sbm] += resource_delta_scaled.y;
-	game.resources[rsc_food] += resource_delta_scaled.z;
+// the sprites of game.textures, in order, baked into ASSET_PACK by oofpack
+struct AssetFile
+{
+	const char* file;
+	const char* name;
+};
 
-	// update building selectors to reflect whether they can be purchased with the current amount of funds
-	UIElement* buildingSelector = getElementByName(&game.gui, "buildingSelector");
-	for (int i = 0; i < buildingSelector->numChildren; i++)
+const AssetFile assetFiles[] = {
+	{"assets" PATH_SEPARATOR "empty.png", "empty"},
+	{"assets" PATH_SEPARATOR "hq.png", "headquarter"},
+	{"assets" PATH_SEPARATOR "mine.png", "mine"},
+	{"assets" PATH_SEPARATOR "plant.png", "powerplant"},
+	{"assets" PATH_SEPARATOR "farm.png", "farm"},
+	{"assets" PATH_SEPARATOR "Shipyard1.png", "headquarter"},
+	{"assets" PATH_SEPARATOR "Shipyard2.png", "powerplant"},
+	{"assets" PATH_SEPARATOR "Shipyard3.png", "farm"},
+};
+#define NUM_ASSETS (int) (sizeof(assetFiles) / sizeof(assetFiles[0]))
+
+// decodes the sprites into a new atlas
+void packAssets(TextureAtlas* atlas, Texture* textures)
+{
+	initAtlas(atlas);
+	for (int i = 0; i < NUM_ASSETS; i++)
+		textures[i] = loadTexture(atlas, assetFiles[i].file, assetFiles[i].name);
+}
+
+// maps the asset pack, or decodes the sprites if there is none that fits
+void loadAssets()
+{
+	game.numTextures = NUM_ASSETS;
+	game.textures = (Texture*) malloc(game.numTextures * sizeof(Texture));
+
+#ifndef HEADLESS
+	for (int i = 0; i < game.numTextures; i++)
+		strcpy(game.textures[i].name, assetFiles[i].name);
+	if (!loadAssetPack(&game.atlas, game.textures, game.numTextures, ASSET_PACK))
+	{
+		LOG_INFO("Decoding the sprites instead, make pack bakes them into %s.\n", ASSET_PACK);
+		packAssets(&game.atlas, game.textures);
+	}
+#else
+	packAssets(&game.atlas, game.textures);
+#endif
+	finishAtlas(&game.atlas, game.textures, game.numTextures);
+}
+
+// copies what the renderer needs into a snapshot and publishes it
+void publishGameSnapshot()
+{
+	SnapshotBuffer* buffer = &game.snapshots;
+	if (!snapshotReserve(buffer, game.ships.num, game.ships.numSlots, game.numPlanets))
+	{
+		LOG_ERROR("Couldn't increase snapshot size, skipping snapshot.\n");
+		return;
+	}
+	Snapshot* s = snapshotBack(buffer);
+
+	s->numPlanets = game.numPlanets;
+	for (int i = 0; i < game.numPlanets; i++)
+	{
+		Planet* p = &game.planets[i];
+		PlanetSnapshot* ps = &s->planets[i];
+		ps->x = p->position.x;
+		ps->y = p->position.y;
+		ps->radius = p->radius;
+		// Todo: set color to white and use pixelshader instead
+		ps->color[0] = p->team/3.f;
+		ps->color[1] = p->shipPresence[0]/100.f;
+		ps->color[2] = p->shipPresence[2];
+	}
+
+	s->numShips = game.ships.num;
+	for (int i = 0; i < game.ships.num; i++)
 	{
-		UIElement* elem = &buildingSelector->children[i];
-		if (game.resources[rsc_sbm] >= game.buildingPrices[elem->data])
+		ShipClass* values = shipClass(i);
+		ShipSnapshot* ship = &s->ships[i];
+		ship->x = game.ships.x[i];
+		ship->y = game.ships.y[i];
+		ship->vx = game.ships.vx[i];
+		ship->vy = game.ships.vy[i];
+		ship->fx = game.ships.fx[i];
+		ship->fy = game.ships.fy[i];
+		ship->health = game.ships.health[i]/values->baseHealth;
+		ship->type = game.ships.type[i];
+		ship->team = game.ships.team[i];
+
+		// the weapon flashes while the target is in range
+		ship->target = -1;
+		int target = resolveShip(game.ships.target[i]);
+		if (target >= 0 && (int)(game.ships.weaponTimer[i]*2) % 2 > 0)
 		{
-			elem->enabled = true;
-			elem->faceColor = vecf(1.f, 1.f, 1.f, 1.f);
-		} else {
-			elem->enabled = false;
-			elem->faceColor = vecf(0.5f, 0.5f, 0.5f, 1.f);
+			if (veclen(vecsub(shipPosition(target), shipPosition(i))) < values->weaponRange)
+				ship->target = target;
 		}
+
+		ShipHandle h = shipHandle(i);
+		snapshotTrack(buffer, i, h.slot, h.generation);
 	}
 
-	printf("Resources: %f %f %f, delta %f %f %f\n", game.resources[0], game.resources[1], game.resources[2], resource_delta.x, resource_delta.y, resource_delta.z);
+	publishSnapshot(buffer, monotonicTime());
 }
 
-void loadAssets()
+#ifndef HEADLESS
+// world geometry is rebuilt every frame and drawn with one call per batch
+#define cruiser_points 10
+Vectorf cruiserShape[cruiser_points];
+DrawBatch worldQuads;
+DrawBatch worldTriangles;
+DrawBatch worldPoints;
+DrawBatch worldLines;
+GLuint worldBuffer = 0;
+
+void initRenderer()
 {
-	game.numTextures = 8;
-	game.textures = (Texture*) malloc(game.numTextures * sizeof(Texture));
-
-	game.textures[0] = loadTexture("assets" PATH_SEPARATOR "empty.png", "empty");
-	game.textures[1] = loadTexture("assets" PATH_SEPARATOR "hq.png", "headquarter");
-	game.textures[2] = loadTexture("assets" PATH_SEPARATOR "mine.png", "mine");
-	game.textures[3] = loadTexture("assets" PATH_SEPARATOR "plant.png", "powerplant");
-	game.textures[4] = loadTexture("assets" PATH_SEPARATOR "farm.png", "farm");
-	game.textures[5] = loadTexture("assets" PATH_SEPARATOR "Shipyard1.png", "headquarter");
-	game.textures[6] = loadTexture("assets" PATH_SEPARATOR "Shipyard2.png", "powerplant");
-	game.textures[7] = loadTexture("assets" PATH_SEPARATOR "Shipyard3.png", "farm");
+	// cruisers are a slightly lopsided decagon
+	for (int i = 0; i < cruiser_points; i++)
+	{
+		int a = i * 36;
+		cruiserShape[i] = vecf(cos(a / (180.f/3.41f)), sin(a / (180.f/3.41f)));
+	}
 }
 
 void renderGame()
 {
+	PROFILE_ZONE("render");
+	uploadAtlas(&game.atlas, ATLAS_UPLOAD_ROWS);
+
 	// Set up projection matrix for game world
 	glMatrixMode( GL_PROJECTION );
 	glLoadIdentity();
@@ -846,85 +1915,69 @@ void renderGame()
 
 	glClear( GL_DEPTH_BUFFER_BIT );
 	// Render world
-	glColor3f(1.f, 1.f, 1.f);
-	for (int i = 0; i < game.numPlanets; i++)
+	drawBatchBegin(&worldQuads, GL_QUADS);
+	drawBatchBegin(&worldTriangles, GL_TRIANGLES);
+	drawBatchBegin(&worldPoints, GL_POINTS);
+	drawBatchBegin(&worldLines, GL_LINES);
+
+	// draw between the last two ticks, which makes the world lag one tick behind
+	Snapshot* snapshot = acquireSnapshot(&game.snapshots);
+	float alpha = 1.f;
+	if (snapshot->interval > 0.0)
+		alpha = (monotonicTime() - snapshot->time) / snapshot->interval;
+	if (alpha > 1.f)
+		alpha = 1.f;
+
+	for (int i = 0; i < snapshot->numPlanets; i++)
 	{
-		float r = game.planets[i].radius/2;
-
-		// Todo: set color to white and use pixelshader instead
-		glColor3f(game.planets[i].team/3.f, game.planets[i].shipPresence[0]/100.f, game.planets[i].shipPresence[2]);
-
-		glPushMatrix();
-			glTranslatef(game.planets[i].position.x, game.planets[i].position.y, 0);
-			glBegin( GL_QUADS );
-				glVertex2f( -r, -r );
-				glVertex2f(  r, -r );
-				glVertex2f(  r,  r );
-				glVertex2f( -r,  r );
-			glEnd();
-		glPopMatrix();
+		PlanetSnapshot* planet = &snapshot->planets[i];
+		DrawColor color = drawColor(planet->color[0], planet->color[1], planet->color[2]);
+		drawBatchSquare(&worldQuads, planet->x, planet->y, planet->radius/2, color);
 	}
 
-	for (int i = 0; i < game.numShips; i++)
+	for (int i = 0; i < snapshot->numShips; i++)
 	{
-		Ship* s = &game.ships[i];
-		if (s->team == 0)
+		ShipSnapshot* ship = &snapshot->ships[i];
+		Vectorf position = vecf(ship->prevx + (ship->x - ship->prevx) * alpha, ship->prevy + (ship->y - ship->prevy) * alpha);
+		DrawColor color;
+		if (ship->team == 0)
 		{
-			glColor3f(0.f, 1.f * (s->health/s->values->baseHealth), 0.f);
+			color = drawColor(0.f, 1.f * ship->health, 0.f);
 		} else {
-			glColor3f(1.f * (s->health/s->values->baseHealth), 0.f, 0.f);
+			color = drawColor(1.f * ship->health, 0.f, 0.f);
+		}
+		switch (ship->type)
+		{
+			case 0:
+				drawBatchVertex(&worldPoints, position.x, position.y, color);
+				break;
+			case 1:
+				drawBatchSquare(&worldQuads, position.x, position.y, 0.2f, color);
+				break;
+			case 2:
+				drawBatchPolygon(&worldTriangles, position.x, position.y, cruiserShape, cruiser_points, color);
+				break;
 		}
-		glPushMatrix();
-			glTranslatef(s->position.x, s->position.y, 0);
-			switch (s->type)
-			{
-				case 0:
-					glBegin( GL_POINTS );
-						glVertex2f(0, 0);
-					glEnd();
-					break;
-				case 1:
-					glBegin( GL_QUADS );
-						glVertex2f(-0.2f, -0.2f);
-						glVertex2f( 0.2f, -0.2f);
-						glVertex2f( 0.2f,  0.2f);
-						glVertex2f(-0.2f,  0.2f);
-					glEnd();
-					break;
-				case 2:
-					glBegin( GL_POLYGON );
-						for (int a = 0; a < 360; a+=36)
-							glVertex2f(cos(a / (180.f/3.41f)), sin(a / (180.f/3.41f)));
-					glEnd();
-					break;
-			}
 
-			glBegin( GL_LINES );
-				if (game.debuglevel >= 1)
-				{
-					glColor3f(1.f, 0.f, 0.f);
-					glVertex2f(0, 0);
-					glVertex2f(s->velocity.x*2, s->velocity.y*2);
-					glColor3f(0.f, 1.f, 0.f);
-					glVertex2f(0, 0);
-					glVertex2f(s->force.x*2, s->force.y*2);
-				}
-				if (s->target != NULL)
-				{
-					if ((int)(s->weaponTimer*2) % 2 > 0)
-					{
-						Vectorf relpos = vecsub(s->target->position, s->position);
-						if (veclen(relpos) < s->values->weaponRange)
-						{
-							glVertex2f(0, 0);
-							glVertex2f(relpos.x, relpos.y);
-						}
-					}
-				}
-			glEnd();
-		glPopMatrix();
+		if (game.debuglevel >= 1)
+		{
+			drawBatchLine(&worldLines, position.x, position.y, position.x + ship->vx*2, position.y + ship->vy*2, drawColor(1.f, 0.f, 0.f));
+			// the weapon line below keeps the force color like it always did
+			color = drawColor(0.f, 1.f, 0.f);
+			drawBatchLine(&worldLines, position.x, position.y, position.x + ship->fx*2, position.y + ship->fy*2, color);
+		}
+		if (ship->target >= 0)
+		{
+			ShipSnapshot* target = &snapshot->ships[ship->target];
+			float tx = target->prevx + (target->x - target->prevx) * alpha;
+			float ty = target->prevy + (target->y - target->prevy) * alpha;
+			drawBatchLine(&worldLines, position.x, position.y, tx, ty, color);
+		}
 	}
 
+	DrawBatch* world[] = {&worldQuads, &worldTriangles, &worldPoints, &worldLines};
+	drawBatches(&worldBuffer, world, 4);
+
 	// Render UI
 
 	// Set up projection matrix for the ui
@@ -936,8 +1989,17 @@ void renderGame()
 	glMatrixMode( GL_MODELVIEW );
 	glLoadIdentity();
 
-	glEnable(GL_BLEND);
-	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-	renderElement(&game.gui);
-	glDisable(GL_BLEND);
-}
\ No newline at end of file
+	{
+		PROFILE_ZONE("render ui");
+		glEnable(GL_BLEND);
+		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+		pthread_mutex_lock(&game.uiLock);
+		renderUI(&game.gui, &game.atlas);
+		pthread_mutex_unlock(&game.uiLock);
+		glDisable(GL_BLEND);
+	}
+#ifdef PROFILE
+	renderProfileOverlay();
+#endif
+}
+#endif
\ No newline at end of file
@@ -0,0 +1,275 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <pthread.h>
+
+// Input events on their way from the window thread to the simulation
+// thread, which applies them before its next tick. Mouse positions are
+// converted to ui and world coordinates by the window thread, since only
+// it knows the window size and the camera. The simulation thread then turns
+// a click into what it does with the ui as it is at that moment, selecting
+// a planet or a building or building on a tile.
+
+#define INPUT_QUEUE_SIZE 256
+
+#define input_none 0 // a click that didn't do anything
+#define input_key 1
+#define input_mouse 2
+#define input_select_planet 3
+#define input_select_building 4
+#define input_build 5
+
+#ifdef HEADLESS
+	// no SDL in headless builds, but replays still contain key presses, these
+	// are the scancodes the simulation reacts to (USB usage ids, like SDL's)
+	#define SDL_SCANCODE_D 7
+	#define SDL_SCANCODE_S 22
+	#define SDL_SCANCODE_ESCAPE 41
+	#define SDL_SCANCODE_SPACE 44
+	#define SDL_SCANCODE_LEFTBRACKET 47
+	#define SDL_SCANCODE_RIGHTBRACKET 48
+	#define SDL_SCANCODE_F5 62
+	#define SDL_SCANCODE_F6 63
+	#define SDL_SCANCODE_F7 64
+	#define SDL_SCANCODE_F9 66
+#endif
+
+struct InputEvent
+{
+	int type;
+	int key; // scancode, or mouse button
+	Vectorf ui; // mouse position in ui coordinates
+	Vectorf world; // mouse position in world coordinates
+
+	// what a click did
+	int planet; // -1 to close the planet popup
+	int tile;
+	int building;
+};
+
+inline InputEvent inputEvent(int type)
+{
+	InputEvent e;
+	memset(&e, 0, sizeof(InputEvent));
+	e.type = type;
+	return e;
+}
+
+struct InputQueue
+{
+	InputEvent events[INPUT_QUEUE_SIZE];
+	int first;
+	int num;
+	pthread_mutex_t lock;
+};
+
+void initInputQueue(InputQueue* q)
+{
+	q->first = 0;
+	q->num = 0;
+	pthread_mutex_init(&q->lock, NULL);
+}
+
+void pushInput(InputQueue* q, InputEvent e)
+{
+	pthread_mutex_lock(&q->lock);
+	if (q->num < INPUT_QUEUE_SIZE)
+	{
+		q->events[(q->first + q->num) % INPUT_QUEUE_SIZE] = e;
+		q->num++;
+	} else {
+		LOG_ERROR("Input queue full, dropping event.\n");
+	}
+	pthread_mutex_unlock(&q->lock);
+}
+
+// moves all queued events to events (room for INPUT_QUEUE_SIZE), returns how many
+int takeInputs(InputQueue* q, InputEvent* events)
+{
+	pthread_mutex_lock(&q->lock);
+	int num = q->num;
+	for (int i = 0; i < num; i++)
+		events[i] = q->events[(q->first + i) % INPUT_QUEUE_SIZE];
+	q->first = (q->first + num) % INPUT_QUEUE_SIZE;
+	q->num = 0;
+	pthread_mutex_unlock(&q->lock);
+	return num;
+}
+
+// Recordings of the events applied by the simulation, stamped with the frame
+// they were applied in. A frame is one step of the simulation loop: apply the
+// queued inputs, then tick with the fixed interval. Together with the state
+// at the start of the recording this is enough to run the exact same session
+// again, see simulateFrame. Clicks are recorded as what they did rather than
+// where they were, so a replay doesn't depend on the window or the ui.
+//
+// Recordings are text, one event per line:
+//
+//	oofinputs <version> <frame rate> <save file with the starting state>
+//	<frame> key <scancode>
+//	<frame> planet <planet>
+//	<frame> building <building>
+//	<frame> build <planet> <tile> <building>
+//	end <number of frames> <checksum of the state when the recording stopped>
+
+#define INPUT_RECORDING_VERSION 2
+
+struct InputRecorder
+{
+	FILE* file; // NULL while not recording
+	int frame;
+};
+
+struct RecordedInput
+{
+	int frame;
+	InputEvent event;
+};
+
+struct InputReplay
+{
+	RecordedInput* events;
+	int numEvents;
+	int next; // first event that wasn't replayed yet
+	int numFrames;
+	int frameRate;
+	char startFile[256];
+	unsigned long long checksum; // a replay has to end with it
+};
+
+bool startRecording(InputRecorder* recorder, const char* filename, int frameRate, const char* startFile)
+{
+	recorder->file = fopen(filename, "w");
+	recorder->frame = 0;
+	if (!recorder->file)
+	{
+		LOG_ERROR("Couldn't open %s for writing.\n", filename);
+		return false;
+	}
+	fprintf(recorder->file, "oofinputs %d %d %s\n", INPUT_RECORDING_VERSION, frameRate, startFile);
+	return true;
+}
+
+void recordInput(InputRecorder* recorder, InputEvent e)
+{
+	if (!recorder->file)
+		return;
+	if (e.type == input_key)
+		fprintf(recorder->file, "%d key %d\n", recorder->frame, e.key);
+	else if (e.type == input_select_planet)
+		fprintf(recorder->file, "%d planet %d\n", recorder->frame, e.planet);
+	else if (e.type == input_select_building)
+		fprintf(recorder->file, "%d building %d\n", recorder->frame, e.building);
+	else if (e.type == input_build)
+		fprintf(recorder->file, "%d build %d %d %d\n", recorder->frame, e.planet, e.tile, e.building);
+}
+
+// called once the frame was simulated
+inline void recordFrame(InputRecorder* recorder)
+{
+	if (recorder->file)
+		recorder->frame++;
+}
+
+// checksum is what a replay of the recording has to end with
+void stopRecording(InputRecorder* recorder, unsigned long long checksum)
+{
+	if (!recorder->file)
+		return;
+	fprintf(recorder->file, "end %d %016llx\n", recorder->frame, checksum);
+	fclose(recorder->file);
+	recorder->file = NULL;
+}
+
+bool loadReplay(InputReplay* replay, const char* filename)
+{
+	memset(replay, 0, sizeof(InputReplay));
+	FILE* file = fopen(filename, "r");
+	if (!file)
+	{
+		LOG_ERROR("Couldn't open %s for reading.\n", filename);
+		return false;
+	}
+	int version;
+	if (fscanf(file, "oofinputs %d %d %255s", &version, &replay->frameRate, replay->startFile) != 3
+		|| version != INPUT_RECORDING_VERSION || replay->frameRate <= 0)
+	{
+		LOG_ERROR("Couldn't load %s, it isn't a version %d input recording.\n", filename, INPUT_RECORDING_VERSION);
+		fclose(file);
+		return false;
+	}
+
+	int len = 0;
+	int lastFrame = 0;
+	bool complete = false;
+	while (!complete)
+	{
+		char type[16];
+		if (fscanf(file, "%15s", type) != 1)
+			break;
+		if (strcmp(type, "end") == 0)
+		{
+			complete = fscanf(file, "%d %llx", &replay->numFrames, &replay->checksum) == 2
+				&& replay->numFrames >= lastFrame;
+			break;
+		}
+		// events come in the order they were applied
+		char* end;
+		long frame = strtol(type, &end, 10);
+		if (end == type || *end != '\0' || frame < lastFrame || frame > INT_MAX)
+			break;
+		lastFrame = (int) frame;
+
+		InputEvent e = inputEvent(input_none);
+		if (fscanf(file, "%15s", type) != 1)
+			break;
+		if (strcmp(type, "key") == 0 && fscanf(file, "%d", &e.key) == 1)
+			e.type = input_key;
+		else if (strcmp(type, "planet") == 0 && fscanf(file, "%d", &e.planet) == 1)
+			e.type = input_select_planet;
+		else if (strcmp(type, "building") == 0 && fscanf(file, "%d", &e.building) == 1)
+			e.type = input_select_building;
+		else if (strcmp(type, "build") == 0 && fscanf(file, "%d %d %d", &e.planet, &e.tile, &e.building) == 3)
+			e.type = input_build;
+		else
+			break;
+
+		if (replay->numEvents == len)
+		{
+			len = len > 0 ? len * 2 : 64;
+			RecordedInput* events = (RecordedInput*) realloc(replay->events, len * sizeof(RecordedInput));
+			if (!events)
+				break;
+			replay->events = events;
+		}
+		replay->events[replay->numEvents].frame = lastFrame;
+		replay->events[replay->numEvents].event = e;
+		replay->numEvents++;
+	}
+	fclose(file);
+	if (!complete)
+	{
+		LOG_ERROR("Couldn't load %s, the recording is damaged or wasn't stopped.\n", filename);
+		free(replay->events);
+		replay->events = NULL;
+		return false;
+	}
+	return true;
+}
+
+// queues the recorded events of the frame, frames must be replayed in order
+void replayFrame(InputReplay* replay, InputQueue* q, int frame)
+{
+	while (replay->next < replay->numEvents && replay->events[replay->next].frame <= frame)
+	{
+		pushInput(q, replay->events[replay->next].event);
+		replay->next++;
+	}
+}
+
+void freeReplay(InputReplay* replay)
+{
+	free(replay->events);
+	memset(replay, 0, sizeof(InputReplay));
+}
\ No newline at end of file
@@ -0,0 +1,239 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+
+// Small work stealing job system. Every worker owns a deque, the thread that
+// calls parallelFor is worker 0 and helps out until its batch is done.
+// Owners pop from the bottom of their deque, idle workers steal from the top
+// of the others. The deques are guarded by a mutex each, jobs are coarse
+// chunks of work so that is cheap enough.
+
+#define JOB_QUEUE_SIZE 1024
+
+typedef void (*JobFunc)(void* data, int begin, int end);
+
+struct JobBatch
+{
+	int remaining; // accessed atomically
+};
+
+struct Job
+{
+	JobFunc func;
+	void* data;
+	int begin;
+	int end;
+	JobBatch* batch;
+};
+
+struct JobQueue
+{
+	Job jobs[JOB_QUEUE_SIZE];
+	int top;    // thieves take from here
+	int bottom; // the owner pushes and pops here
+	pthread_mutex_t lock;
+};
+
+struct JobSystem
+{
+	JobQueue *queues;
+	pthread_t *threads;
+	int numWorkers;
+
+	int queued; // jobs waiting in any queue, accessed atomically
+	bool quit;
+	pthread_mutex_t sleepLock;
+	pthread_cond_t wake;
+};
+
+JobSystem jobs;
+
+bool pushJob(JobQueue* q, Job job)
+{
+	pthread_mutex_lock(&q->lock);
+	bool success = q->bottom - q->top < JOB_QUEUE_SIZE;
+	if (success)
+	{
+		q->jobs[q->bottom % JOB_QUEUE_SIZE] = job;
+		q->bottom++;
+	}
+	pthread_mutex_unlock(&q->lock);
+	return success;
+}
+
+bool popJob(JobQueue* q, Job* job)
+{
+	pthread_mutex_lock(&q->lock);
+	bool success = q->bottom > q->top;
+	if (success)
+	{
+		q->bottom--;
+		*job = q->jobs[q->bottom % JOB_QUEUE_SIZE];
+	}
+	pthread_mutex_unlock(&q->lock);
+	return success;
+}
+
+bool stealJob(JobQueue* q, Job* job)
+{
+	pthread_mutex_lock(&q->lock);
+	bool success = q->bottom > q->top;
+	if (success)
+	{
+		*job = q->jobs[q->top % JOB_QUEUE_SIZE];
+		q->top++;
+	}
+	pthread_mutex_unlock(&q->lock);
+	return success;
+}
+
+// take a job from the own queue or steal one from the others
+bool findJob(int worker, Job* job)
+{
+	if (popJob(&jobs.queues[worker], job))
+		return true;
+	for (int i = 1; i < jobs.numWorkers; i++)
+	{
+		if (stealJob(&jobs.queues[(worker + i) % jobs.numWorkers], job))
+			return true;
+	}
+	return false;
+}
+
+void runJob(Job* job)
+{
+	__atomic_fetch_sub(&jobs.queued, 1, __ATOMIC_RELAXED);
+	job->func(job->data, job->begin, job->end);
+	__atomic_fetch_sub(&job->batch->remaining, 1, __ATOMIC_RELEASE);
+}
+
+void* workerMain(void* arg)
+{
+	int worker = (int) (intptr_t) arg;
+
+	while (true)
+	{
+		Job job;
+		if (findJob(worker, &job))
+		{
+			runJob(&job);
+			continue;
+		}
+
+		pthread_mutex_lock(&jobs.sleepLock);
+		while (!jobs.quit && __atomic_load_n(&jobs.queued, __ATOMIC_ACQUIRE) == 0)
+			pthread_cond_wait(&jobs.wake, &jobs.sleepLock);
+		bool quit = jobs.quit;
+		pthread_mutex_unlock(&jobs.sleepLock);
+		if (quit)
+			break;
+	}
+	return NULL;
+}
+
+// numWorkers <= 0 uses one worker per hardware thread
+void initJobs(int numWorkers)
+{
+	if (numWorkers <= 0)
+		numWorkers = (int) sysconf(_SC_NPROCESSORS_ONLN);
+	if (numWorkers <= 0)
+		numWorkers = 1;
+
+	jobs.numWorkers = numWorkers;
+	jobs.queued = 0;
+	jobs.quit = false;
+	jobs.queues = (JobQueue*) malloc(numWorkers * sizeof(JobQueue));
+	jobs.threads = (pthread_t*) malloc(numWorkers * sizeof(pthread_t));
+	pthread_mutex_init(&jobs.sleepLock, NULL);
+	pthread_cond_init(&jobs.wake, NULL);
+	for (int i = 0; i < numWorkers; i++)
+	{
+		jobs.queues[i].top = 0;
+		jobs.queues[i].bottom = 0;
+		pthread_mutex_init(&jobs.queues[i].lock, NULL);
+	}
+
+	// worker 0 is the thread calling parallelFor
+	for (int i = 1; i < numWorkers; i++)
+	{
+		if (pthread_create(&jobs.threads[i], NULL, workerMain, (void*) (intptr_t) i) != 0)
+		{
+			LOG_ERROR("Couldn't start worker thread %d, using %d workers.\n", i, i);
+			jobs.numWorkers = i;
+			break;
+		}
+	}
+	LOG_INFO("Using %d worker threads\n", jobs.numWorkers);
+}
+
+void shutdownJobs()
+{
+	pthread_mutex_lock(&jobs.sleepLock);
+	jobs.quit = true;
+	pthread_cond_broadcast(&jobs.wake);
+	pthread_mutex_unlock(&jobs.sleepLock);
+	for (int i = 1; i < jobs.numWorkers; i++)
+		pthread_join(jobs.threads[i], NULL);
+	for (int i = 0; i < jobs.numWorkers; i++)
+		pthread_mutex_destroy(&jobs.queues[i].lock);
+	free(jobs.queues);
+	free(jobs.threads);
+	jobs.queues = NULL;
+	jobs.threads = NULL;
+	jobs.numWorkers = 0;
+}
+
+// calls func(data, begin, end) for consecutive chunks of [0, n) and returns once
+// all of them are done. Chunks don't depend on the number of workers, so jobs
+// that only write to their own range give the same result for any thread count.
+void parallelFor(int n, int chunkSize, JobFunc func, void* data)
+{
+	if (n <= 0)
+		return;
+	if (jobs.numWorkers <= 1 || n <= chunkSize)
+	{
+		for (int begin = 0; begin < n; begin += chunkSize)
+			func(data, begin, begin + chunkSize < n ? begin + chunkSize : n);
+		return;
+	}
+
+	JobBatch batch;
+	batch.remaining = 0;
+	int numChunks = (n + chunkSize - 1) / chunkSize;
+	for (int c = 0; c < numChunks; c++)
+	{
+		Job job;
+		job.func = func;
+		job.data = data;
+		job.begin = c * chunkSize;
+		job.end = job.begin + chunkSize < n ? job.begin + chunkSize : n;
+		job.batch = &batch;
+
+		__atomic_fetch_add(&batch.remaining, 1, __ATOMIC_RELAXED);
+		__atomic_fetch_add(&jobs.queued, 1, __ATOMIC_RELEASE);
+		if (!pushJob(&jobs.queues[c % jobs.numWorkers], job))
+		{
+			// queue is full, just do it right here
+			__atomic_fetch_sub(&jobs.queued, 1, __ATOMIC_RELAXED);
+			func(data, job.begin, job.end);
+			__atomic_fetch_sub(&batch.remaining, 1, __ATOMIC_RELAXED);
+		}
+	}
+
+	pthread_mutex_lock(&jobs.sleepLock);
+	pthread_cond_broadcast(&jobs.wake);
+	pthread_mutex_unlock(&jobs.sleepLock);
+
+	// help out until the whole batch is done, jobs of other batches are fine too
+	while (__atomic_load_n(&batch.remaining, __ATOMIC_ACQUIRE) > 0)
+	{
+		Job job;
+		if (findJob(0, &job))
+			runJob(&job);
+		else
+			sched_yield();
+	}
+}
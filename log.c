@@ -0,0 +1,199 @@
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+
+// Asynchronous logging. LOG_* calls format their message into a slot of a
+// lock-free ring buffer and return, a background thread writes the slots
+// out, so the tick never waits for the terminal. A full buffer drops
+// messages instead of blocking, and every call site is rate limited.
+//
+// The varargs of a call don't outlive it, so the message is formatted by
+// the caller, only the writing happens in the background.
+//
+// Before initLog and after shutdownLog messages are written directly.
+
+#define log_error 0
+#define log_info 1
+#define log_debug 2
+
+#define LOG_LINE_SIZE 256
+#define LOG_RING_SIZE 1024 // must be a power of two
+#define LOG_RATE_LIMIT 20 // messages per second and call site
+
+// the most verbose level that is written, defined by the game
+int logMaxLevel();
+double monotonicTime(); // see profiler.c
+
+struct LogEntry
+{
+	unsigned sequence; // accessed atomically
+	char text[LOG_LINE_SIZE];
+};
+
+// rate limit state of one call site, sites in shared code are used by the
+// simulation thread and the job workers alike, so everything is accessed
+// atomically
+struct LogSite
+{
+	double windowStart;
+	int count;
+	int dropped;
+};
+
+struct Log
+{
+	LogEntry entries[LOG_RING_SIZE];
+	unsigned writePos; // accessed atomically
+	unsigned readPos; // only used by the log thread
+	int dropped; // messages lost to a full buffer, accessed atomically
+
+	pthread_t thread;
+	bool running;
+	bool quit; // accessed atomically
+};
+
+Log logs;
+
+// multiple producer, single consumer bounded queue, see Dmitry Vyukov's bounded MPMC queue
+bool logPush(const char* text)
+{
+	unsigned pos = __atomic_load_n(&logs.writePos, __ATOMIC_RELAXED);
+	LogEntry* entry;
+	while (true)
+	{
+		entry = &logs.entries[pos % LOG_RING_SIZE];
+		unsigned sequence = __atomic_load_n(&entry->sequence, __ATOMIC_ACQUIRE);
+		int diff = (int) (sequence - pos);
+		if (diff == 0)
+		{
+			if (__atomic_compare_exchange_n(&logs.writePos, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				break;
+		} else if (diff < 0) {
+			return false; // full
+		} else {
+			pos = __atomic_load_n(&logs.writePos, __ATOMIC_RELAXED);
+		}
+	}
+	strncpy(entry->text, text, LOG_LINE_SIZE - 1);
+	entry->text[LOG_LINE_SIZE - 1] = '\0';
+	__atomic_store_n(&entry->sequence, pos + 1, __ATOMIC_RELEASE);
+	return true;
+}
+
+// writes out everything that is queued, returns the number of messages
+int logFlush()
+{
+	int written = 0;
+	while (true)
+	{
+		LogEntry* entry = &logs.entries[logs.readPos % LOG_RING_SIZE];
+		if (__atomic_load_n(&entry->sequence, __ATOMIC_ACQUIRE) != logs.readPos + 1)
+			break;
+		fputs(entry->text, stdout);
+		__atomic_store_n(&entry->sequence, logs.readPos + LOG_RING_SIZE, __ATOMIC_RELEASE);
+		logs.readPos++;
+		written++;
+	}
+	int dropped = __atomic_exchange_n(&logs.dropped, 0, __ATOMIC_RELAXED);
+	if (dropped > 0)
+		printf("(log buffer full, dropped %d messages)\n", dropped);
+	if (written > 0 || dropped > 0)
+		fflush(stdout);
+	return written;
+}
+
+void* logMain(void*)
+{
+	while (true)
+	{
+		bool quit = __atomic_load_n(&logs.quit, __ATOMIC_ACQUIRE);
+		if (logFlush() == 0)
+		{
+			if (quit)
+				break;
+			usleep(2000);
+		}
+	}
+	return NULL;
+}
+
+void initLog()
+{
+	for (int i = 0; i < LOG_RING_SIZE; i++)
+		logs.entries[i].sequence = i;
+	logs.writePos = 0;
+	logs.readPos = 0;
+	logs.dropped = 0;
+	logs.quit = false;
+	logs.running = pthread_create(&logs.thread, NULL, logMain, NULL) == 0;
+	if (!logs.running)
+		printf("Couldn't start log thread, logging synchronously.\n");
+}
+
+// writes all remaining messages and stops the log thread
+void shutdownLog()
+{
+	if (!logs.running)
+		return;
+	__atomic_store_n(&logs.quit, true, __ATOMIC_RELEASE);
+	pthread_join(logs.thread, NULL);
+	logs.running = false;
+}
+
+// true if the site may log another message right now
+bool logRateLimit(LogSite* site, double now)
+{
+	// only the thread that moves the window on starts the new one
+	double windowStart;
+	__atomic_load(&site->windowStart, &windowStart, __ATOMIC_RELAXED);
+	if (now - windowStart >= 1.0
+		&& __atomic_compare_exchange(&site->windowStart, &windowStart, &now, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+	{
+		__atomic_store_n(&site->count, 0, __ATOMIC_RELAXED);
+		int dropped = __atomic_exchange_n(&site->dropped, 0, __ATOMIC_RELAXED);
+		if (dropped > 0)
+		{
+			char text[LOG_LINE_SIZE];
+			snprintf(text, sizeof(text), "(%d similar messages dropped)\n", dropped);
+			if (!logs.running || !logPush(text))
+				fputs(text, stdout);
+		}
+	}
+	if (__atomic_fetch_add(&site->count, 1, __ATOMIC_RELAXED) >= LOG_RATE_LIMIT)
+	{
+		__atomic_fetch_add(&site->dropped, 1, __ATOMIC_RELAXED);
+		return false;
+	}
+	return true;
+}
+
+__attribute__((format(printf, 2, 3)))
+void logWrite(LogSite* site, const char* format, ...)
+{
+	if (!logRateLimit(site, monotonicTime()))
+		return;
+
+	char text[LOG_LINE_SIZE];
+	va_list args;
+	va_start(args, format);
+	vsnprintf(text, sizeof(text), format, args);
+	va_end(args);
+
+	if (!logs.running)
+		fputs(text, stdout);
+	else if (!logPush(text))
+		__atomic_fetch_add(&logs.dropped, 1, __ATOMIC_RELAXED);
+}
+
+#define LOG(level, ...) do { \
+		if ((level) <= logMaxLevel()) \
+		{ \
+			static LogSite logSite; \
+			logWrite(&logSite, __VA_ARGS__); \
+		} \
+	} while (0)
+#define LOG_ERROR(...) LOG(log_error, __VA_ARGS__)
+#define LOG_INFO(...) LOG(log_info, __VA_ARGS__)
+#define LOG_DEBUG(...) LOG(log_debug, __VA_ARGS__)
\ No newline at end of file
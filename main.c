@@ -1,5 +1,6 @@
 #include <stdio.h>
 #include <stdbool.h> 
+#define GL_GLEXT_PROTOTYPES
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_opengl.h>
 #include <GL/glu.h>
@@ -7,6 +8,7 @@
 #include <stdint.h>
 
 #include <fenv.h>
+#include <errno.h>
 #include "game.c"
 
 unsigned GetTickCount()
@@ -24,7 +26,37 @@ SDL_Window* gWindow = NULL;
 //OpenGL context
 SDL_GLContext gContext;
 
-unsigned lastTick;
+// the simulation runs on its own thread at a fixed rate, SIM_TICK_RATE
+pthread_t simThread;
+bool simQuit = false; // accessed atomically
+
+void sleepUntil(double time)
+{
+	struct timespec ts;
+	ts.tv_sec = (time_t) time;
+	ts.tv_nsec = (long) ((time - ts.tv_sec) * 1e9);
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+}
+
+void* simMain(void*)
+{
+	PROFILE_THREAD(1);
+	double interval = 1.0 / SIM_TICK_RATE;
+	double next = monotonicTime();
+	while (!__atomic_load_n(&simQuit, __ATOMIC_ACQUIRE))
+	{
+		simulateFrame(interval);
+		publishGameSnapshot();
+
+		next += interval;
+		double now = monotonicTime();
+		// fell far behind, don't try to catch up
+		if (next < now - 0.1)
+			next = now;
+		sleepUntil(next);
+	}
+	return NULL;
+}
 
 bool initGL()
 {
@@ -136,6 +168,9 @@ int main(int argc, char const *argv[])
 {
 	// make sure to catch sources of NAN and INF
 	feenableexcept(FE_INVALID | FE_OVERFLOW);
+	initLog();
+	initBatchKernels();
+	initJobs(0);
 	game.window_width = 640;
 	game.window_height = 420;
 	if (!initLibs(game.window_width, game.window_height))
@@ -153,69 +188,31 @@ int main(int argc, char const *argv[])
 		// Enable text input
 		SDL_StartTextInput();
 
-		// define ship classes
-		ShipClass fighter;
-		fighter.acceleration = 0.5f;
-		fighter.speed = 5.f;
-		fighter.damageModifiers[0] = 50.f;
-		fighter.damageModifiers[1] = 100.f;
-		fighter.damageModifiers[2] = 5.f;
-		fighter.sensorRange = 15.f;
-		fighter.weaponRange = 7.5f;
-		fighter.fireSpeed = 10.f;
-		fighter.baseHealth = 100.f;
-		fighter.energyUsage = 0.01f;
-		fighter.buildCost = 0.2f;
-		game.shipClasses[0] = fighter;
-
-		ShipClass bomber;
-		bomber.acceleration = 0.1f;
-		bomber.speed = 3.f;
-		bomber.damageModifiers[0] = 5.f;
-		bomber.damageModifiers[1] = 50.f;
-		bomber.damageModifiers[2] = 100.f;
-		bomber.sensorRange = 30.f;
-		bomber.weaponRange = 7.5f;
-		bomber.fireSpeed = 1.f;
-		bomber.baseHealth = 100.f;
-		bomber.energyUsage = 0.02f;
-		bomber.buildCost = 1.f;
-		game.shipClasses[1] = bomber;
-
-		ShipClass cruiser;
-		cruiser.acceleration = 0.2f;
-		cruiser.speed = 2.f;
-		cruiser.damageModifiers[0] = 100.f;
-		cruiser.damageModifiers[1] = 100.f;
-		cruiser.damageModifiers[2] = 25.f;
-		cruiser.sensorRange = 50.f;
-		cruiser.weaponRange = 7.5f;
-		cruiser.fireSpeed = 0.5f;
-		cruiser.baseHealth = 1000.f;
-		cruiser.energyUsage = 0.5f;
-		cruiser.buildCost = 5.f;
-		game.shipClasses[2] = cruiser;
-
-		game.buildingPrices[0] = 0;
-		game.buildingPrices[1] = 0;
-		game.buildingPrices[2] = 100;
-		game.buildingPrices[3] = 100;
-		game.buildingPrices[4] = 100;
-		game.buildingPrices[5] = 250;
-		game.buildingPrices[6] = 500;
-		game.buildingPrices[7] = 1000;
+		// define ship classes and building prices
+		initGameValues();
 
 		if (argc > 1)
 			newGame(strtol(argv[1], NULL, 10), 250, 15);
 		else
 			newGame(GetTickCount(), 250, 15);
 		loadAssets();
+		initRenderer();
 		createUI();
 		game.window_width = 640;
 		game.window_height = 420;
 		game.aspectRatio = 640.f / 420.f;
 		game.debuglevel = 0;
 
+		initInputQueue(&game.inputs);
+		initSnapshots(&game.snapshots);
+		publishGameSnapshot();
+		if (pthread_create(&simThread, NULL, simMain, NULL) != 0)
+		{
+			printf("Couldn't start simulation thread!\n");
+			close();
+			return 1;
+		}
+
 		//While game not terminating
 		while( !quit )
 		{
@@ -226,18 +223,21 @@ int main(int argc, char const *argv[])
 					quit = true;
 				}
 
-				// Handle keypress with current mouse position
+				// keys for the game go to the simulation thread
 				else if( e.type == SDL_KEYDOWN )
 				{
-					int x = 0, y = 0;
-					SDL_GetMouseState( &x, &y );
-					handleKeys( e.key.keysym.scancode, x, y );
+					handleViewKeys( e.key.keysym.scancode );
+					InputEvent input = inputEvent(input_key);
+					input.key = e.key.keysym.scancode;
+					pushInput(&game.inputs, input);
 				}
 
 				// process resizing
 				else if (e.window.event == SDL_WINDOWEVENT_RESIZED)
 				{
+					pthread_mutex_lock(&game.uiLock);
 					resizeWindow(e);
+					pthread_mutex_unlock(&game.uiLock);
 				}
 
 				// zoom
@@ -257,30 +257,30 @@ int main(int argc, char const *argv[])
 				{
 					if (e.button.button == SDL_BUTTON_LEFT || e.button.button == SDL_BUTTON_RIGHT)
 					{
-						handleMouseButtons(e.button.button, e.button.x, e.button.y);
+						pushInput(&game.inputs, mouseEvent(e.button.button, e.button.x, e.button.y));
 					}
 				}
 			}
 
-			float step = (GetTickCount() - lastTick) / 1000.0;
-			lastTick = GetTickCount();
-
-			if (step > 0.1f)
-			{
-				step = 0.1f;
-			}
-
-			tickGame(step, game.steplimiting);
-
 			//Render quad
 			renderGame();
 			
 			//Update screen
-			SDL_GL_SwapWindow( gWindow );
+			{
+				PROFILE_ZONE("swap");
+				SDL_GL_SwapWindow( gWindow );
+			}
+			PROFILE_END_FRAME();
 		}
 		
+		__atomic_store_n(&simQuit, true, __ATOMIC_RELEASE);
+		pthread_join(simThread, NULL);
+		stopRecording(&game.recorder, gameChecksum());
+
 		//Disable text input
 		SDL_StopTextInput();
+		shutdownJobs();
+		shutdownLog();
 
 	return 0;
 }
\ No newline at end of file
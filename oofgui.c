@@ -1,17 +1,31 @@
 #include <stdio.h>
 #include <stdbool.h> 
-#include <SDL2/SDL.h>
-#include <SDL2/SDL_opengl.h>
-#include <GL/glu.h>
+#ifndef HEADLESS
+	#include <SDL2/SDL.h>
+	#include <SDL2/SDL_opengl.h>
+	#include <GL/glu.h>
+#endif
 #include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
 #include <math.h>
 
+// All elements of a ui live in one fixed array, so element pointers stay
+// valid for the lifetime of the ui. The children of an element are
+// contiguous in the array and always come after their parent.
+//
+// The renderer keeps the geometry of the whole ui in one vertex buffer.
+// Whoever changes an element has to mark the ui dirty, the next frame then
+// recomputes the absolute rectangles and rebuilds the buffer.
+
+#define UI_MAX_ELEMENTS 256
+
 struct UIElement
 {
 	char name[100];
-	Vectorf position;
+	Vectorf position; // relative to the parent, as a fraction of its size
 	Vectorf size;
-	void (*onClick)(UIElement* source);
+	InputEvent (*onClick)(UIElement* source); // what a click on the element does, see input.c
 	int data;
 
 	UIElement *parent;
@@ -24,41 +38,105 @@ struct UIElement
 
 	bool visible;
 	bool enabled;
+
+	// computed by layoutUI
+	Vectorf absPosition;
+	Vectorf absSize;
+	bool shown; // visible and all its parents are
 };
 
-UIElement* addChild(UIElement* root)
+struct UI
+{
+	UIElement elements[UI_MAX_ELEMENTS]; // elements[0] is the root
+	int numElements;
+	bool dirty; // an element changed since the geometry was built
+	Vectorf pixelSize; // of a window pixel in ui coordinates, how thick borders are
+};
+
+void initElement(UIElement* elem)
 {
-	//printf("spawning child element\n");
-	root->numChildren += 1;
-	UIElement* newarray = (UIElement*) realloc(root->children, root->numChildren * sizeof(UIElement));
-	if (newarray)
-	{
-		root->children = newarray;
-	}
-	else
-	{
-		printf("Couldn't increase array size, aborting element creation.\n");
-		return NULL;
-	}
-	UIElement* elem = &root->children[root->numChildren - 1];
 	strcpy(elem->name, "");
-	elem->parent = root;
+	elem->parent = NULL;
 	elem->numChildren = 0;
 	elem->children = NULL;
 	elem->position = vecf(0.f, 0.f);
 	elem->size = vecf(0.f, 0.f);
 	elem->texture = NULL;
 	elem->onClick = NULL;
+	elem->data = 0;
 	elem->visible = true;
 	elem->borderColor = vecf(0.f, 0.f, 0.f, 0.f);
 	elem->faceColor = vecf(0.f, 0.f, 0.f, 0.f);
 	elem->enabled = true;
+}
+
+// clears the ui down to an empty root element that covers everything
+UIElement* initUI(UI* ui)
+{
+	UIElement* root = &ui->elements[0];
+	initElement(root);
+	root->size = vecf(1.f, 1.f);
+	ui->numElements = 1;
+	ui->dirty = true;
+	ui->pixelSize = vecf(1.f / 640.f, 1.f / 480.f);
+	return root;
+}
+
+inline UIElement* uiRoot(UI* ui)
+{
+	return &ui->elements[0];
+}
+
+// children are contiguous, so an element that already has children can only
+// get more while its children are the last elements of the ui
+UIElement* addChild(UI* ui, UIElement* root)
+{
+	//printf("spawning child element\n");
+	if (ui->numElements == UI_MAX_ELEMENTS)
+	{
+		LOG_ERROR("Couldn't add element, the ui is full.\n");
+		return NULL;
+	}
+	UIElement* elem = &ui->elements[ui->numElements];
+	if (root->numChildren > 0 && root->children + root->numChildren != elem)
+	{
+		LOG_ERROR("Couldn't add element to %s, its children aren't the last elements.\n", root->name);
+		return NULL;
+	}
+	ui->numElements++;
+	initElement(elem);
+	elem->parent = root;
+	if (root->numChildren == 0)
+		root->children = elem;
+	root->numChildren++;
+	ui->dirty = true;
 	return elem;
 }
 
+// absolute rectangles of all elements, parents come before their children
+void layoutUI(UI* ui)
+{
+	for (int i = 0; i < ui->numElements; i++)
+	{
+		UIElement* elem = &ui->elements[i];
+		if (!elem->parent)
+		{
+			elem->absPosition = elem->position;
+			elem->absSize = elem->size;
+			elem->shown = elem->visible;
+			continue;
+		}
+		UIElement* parent = elem->parent;
+		elem->absPosition = vecadd(parent->absPosition, vecmult(elem->position, parent->absSize));
+		elem->absSize = vecmult(elem->size, parent->absSize);
+		elem->shown = elem->visible && parent->shown;
+	}
+}
+
 UIElement* getElementAt(UIElement* root, float x, float y)
 {
-	if (!root->visible)
+	// elements without an area can't be hit, and would divide by zero
+	if (!root->visible || root->size.x <= 0.f || root->size.y <= 0.f)
 		return NULL;
 	x -= root->position.x;
 	y -= root->position.y;
@@ -78,52 +156,229 @@ UIElement* getElementAt(UIElement* root, float x, float y)
 	return root;
 }
 
-UIElement* getElementByName(UIElement* root, char* name)
+// Named elements are looked up through a hash index instead of walking the
+// tree. Names are usually set after addChild, so the index is built once the
+// ui is complete and has to be rebuilt if named elements are added later.
+
+#define UI_INDEX_SIZE 64 // power of two, keep it at least twice the number of named elements
+
+struct UIIndex
 {
-	// printf("comparing %s and %s %d\n", root->name, name, strcmp(root->name, name));
-	if (strcmp(root->name, name) == 0)
-		return root;
-	for (int i = 0; i < root->numChildren; i++)
+	UIElement* elements[UI_INDEX_SIZE]; // open addressing, NULL if empty
+};
+
+inline unsigned int hashName(const char* name)
+{
+	unsigned int hash = 2166136261u;
+	for (; *name; name++)
 	{
-		UIElement* elem = getElementByName(&root->children[i], name);
-		if (elem)
+		hash ^= (unsigned char) *name;
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+void buildUIIndex(UIIndex* index, UI* ui)
+{
+	memset(index, 0, sizeof(UIIndex));
+	for (int i = 0; i < ui->numElements; i++)
+	{
+		UIElement* elem = &ui->elements[i];
+		if (elem->name[0] == '\0')
+			continue;
+		unsigned int slot = hashName(elem->name);
+		int probes = 0;
+		while (index->elements[slot % UI_INDEX_SIZE] && probes < UI_INDEX_SIZE)
+		{
+			slot++;
+			probes++;
+		}
+		if (probes < UI_INDEX_SIZE)
+			index->elements[slot % UI_INDEX_SIZE] = elem;
+		else
+			LOG_ERROR("Couldn't index element %s, the ui index is full.\n", elem->name);
+	}
+}
+
+UIElement* findElement(UIIndex* index, const char* name)
+{
+	unsigned int slot = hashName(name);
+	for (int probes = 0; probes < UI_INDEX_SIZE; probes++, slot++)
+	{
+		UIElement* elem = index->elements[slot % UI_INDEX_SIZE];
+		if (!elem)
+			return NULL;
+		if (strcmp(elem->name, name) == 0)
 			return elem;
 	}
 	return NULL;
 }
 
-void renderElement(UIElement* root)
+#ifndef HEADLESS
+// The ui is drawn in tree order, each element's border and face before its
+// children, so overlapping elements stack the same way they always did.
+// All textures are regions of one atlas, and untextured borders and faces
+// use its white region. Borders are four quads a pixel thick instead of
+// lines, so the whole ui is one range of quads, drawn with a single bind
+// and a single call.
+
+struct UIVertex
+{
+	float x;
+	float y;
+	float u;
+	float v;
+	GLubyte color[4];
+};
+
+struct UIDrawRange
+{
+	GLuint texture;
+	int first;
+	int count;
+};
+
+struct UIDrawItem
+{
+	int layer; // 0 border, 1 face
+	int element;
+};
+
+struct UIRenderer
+{
+	GLuint buffer;
+	UIVertex vertices[UI_MAX_ELEMENTS * 20]; // a border is 16 vertices, a face 4
+	UIDrawRange ranges[UI_MAX_ELEMENTS * 2];
+	int numRanges;
+};
+
+UIRenderer uiRenderer;
+
+inline void uiVertex(UIVertex* v, float x, float y, float u, float t, Vectorf color)
+{
+	v->x = x;
+	v->y = y;
+	v->u = u;
+	v->v = t;
+	memcpy(v->color, drawColor(color.x, color.y, color.z, color.w).rgba, 4);
+}
+
+// an untextured rectangle, returns the vertex after it
+inline UIVertex* uiRect(UIVertex* v, float x0, float y0, float x1, float y1, Texture* white, Vectorf color)
 {
-	if (!root->visible)
+	uiVertex(v++, x0, y0, white->u0, white->v0, color);
+	uiVertex(v++, x1, y0, white->u0, white->v0, color);
+	uiVertex(v++, x1, y1, white->u0, white->v0, color);
+	uiVertex(v++, x0, y1, white->u0, white->v0, color);
+	return v;
+}
+
+// with blending on, transparent borders and faces don't draw anything
+void addUIDrawItems(UI* ui, UIElement* elem, UIDrawItem* items, int* numItems)
+{
+	if (!elem->shown)
 		return;
-	glPushMatrix();
-	glTranslatef(root->position.x, root->position.y, 0.f);
-	glScalef(root->size.x, root->size.y, 1.f);
-
-	// render element
-	glColor4fv(&root->borderColor.x);
-	glBegin(GL_LINE_LOOP);
-		glVertex2f(0.f, 0.f);
-		glVertex2f(1.f, 0.f);
-		glVertex2f(1.f, 1.f);
-		glVertex2f(0.f, 1.f);
-	glEnd();
-	
-	bindTexture(root->texture);
-	glColor4fv(&root->faceColor.x);
-	glBegin(GL_QUADS);
-		glVertex2f(0.f, 0.f); glTexCoord2f(1.f, 0.f);
-		glVertex2f(1.f, 0.f); glTexCoord2f(1.f, 1.f);
-		glVertex2f(1.f, 1.f); glTexCoord2f(0.f, 1.f);
-		glVertex2f(0.f, 1.f); glTexCoord2f(0.f, 0.f);
-	glEnd();
-	unbindTexture(root->texture);
-	
-	// render child elements
-	for (int i = 0; i < root->numChildren; i++)
+	int i = (int) (elem - ui->elements);
+	if (elem->borderColor.w > 0.f)
+		items[(*numItems)++] = {0, i};
+	if (elem->faceColor.w > 0.f)
+		items[(*numItems)++] = {1, i};
+	for (int c = 0; c < elem->numChildren; c++)
+		addUIDrawItems(ui, &elem->children[c], items, numItems);
+}
+
+// lays out the ui and puts the geometry of everything shown into the buffer,
+// untextured parts are drawn with the region white
+void buildUIGeometry(UI* ui, Texture* white)
+{
+	layoutUI(ui);
+
+	UIDrawItem items[UI_MAX_ELEMENTS * 2];
+	int numItems = 0;
+	addUIDrawItems(ui, uiRoot(ui), items, &numItems);
+
+	int numVertices = 0;
+	uiRenderer.numRanges = 0;
+	for (int i = 0; i < numItems; i++)
 	{
-		renderElement(&root->children[i]);
+		UIElement* elem = &ui->elements[items[i].element];
+		float x0 = elem->absPosition.x;
+		float y0 = elem->absPosition.y;
+		float x1 = x0 + elem->absSize.x;
+		float y1 = y0 + elem->absSize.y;
+		Texture* t = items[i].layer == 1 && elem->texture ? elem->texture : white;
+		int first = numVertices;
+
+		UIVertex* v = &uiRenderer.vertices[numVertices];
+		if (items[i].layer == 0)
+		{
+			// top and bottom across the whole width, the sides between them so the corners don't blend twice
+			Vectorf c = elem->borderColor;
+			float w = ui->pixelSize.x;
+			float h = ui->pixelSize.y;
+			v = uiRect(v, x0, y0, x1, y0 + h, t, c);
+			v = uiRect(v, x0, y1 - h, x1, y1, t, c);
+			v = uiRect(v, x0, y0 + h, x0 + w, y1 - h, t, c);
+			v = uiRect(v, x1 - w, y0 + h, x1, y1 - h, t, c);
+			numVertices += 16;
+		} else {
+			Vectorf c = elem->faceColor;
+			uiVertex(v++, x0, y0, t->u0, t->v0, c);
+			uiVertex(v++, x1, y0, t->u1, t->v0, c);
+			uiVertex(v++, x1, y1, t->u1, t->v1, c);
+			uiVertex(v++, x0, y1, t->u0, t->v1, c);
+			numVertices += 4;
+		}
+
+		UIDrawRange* last = uiRenderer.numRanges > 0 ? &uiRenderer.ranges[uiRenderer.numRanges - 1] : NULL;
+		if (last && last->texture == t->handle)
+		{
+			last->count += numVertices - first;
+		} else {
+			UIDrawRange* range = &uiRenderer.ranges[uiRenderer.numRanges++];
+			range->texture = t->handle;
+			range->first = first;
+			range->count = numVertices - first;
+		}
 	}
 
-	glPopMatrix();
-}
\ No newline at end of file
+	if (uiRenderer.buffer == 0)
+		glGenBuffers(1, &uiRenderer.buffer);
+	glBindBuffer(GL_ARRAY_BUFFER, uiRenderer.buffer);
+	glBufferData(GL_ARRAY_BUFFER, numVertices * sizeof(UIVertex), uiRenderer.vertices, GL_DYNAMIC_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	ui->dirty = false;
+}
+
+// draws the ui in ui coordinates, rebuilds its geometry first if it changed
+void renderUI(UI* ui, TextureAtlas* atlas)
+{
+	if (ui->dirty || uiRenderer.buffer == 0)
+		buildUIGeometry(ui, &atlas->white);
+
+	glBindBuffer(GL_ARRAY_BUFFER, uiRenderer.buffer);
+	glEnableClientState(GL_VERTEX_ARRAY);
+	glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+	glEnableClientState(GL_COLOR_ARRAY);
+	glVertexPointer(2, GL_FLOAT, sizeof(UIVertex), (const void*) offsetof(UIVertex, x));
+	glTexCoordPointer(2, GL_FLOAT, sizeof(UIVertex), (const void*) offsetof(UIVertex, u));
+	glColorPointer(4, GL_UNSIGNED_BYTE, sizeof(UIVertex), (const void*) offsetof(UIVertex, color));
+	glEnable(GL_TEXTURE_2D);
+	GLuint bound = 0;
+	for (int i = 0; i < uiRenderer.numRanges; i++)
+	{
+		UIDrawRange* range = &uiRenderer.ranges[i];
+		if (range->texture != bound)
+		{
+			glBindTexture(GL_TEXTURE_2D, range->texture);
+			bound = range->texture;
+		}
+		glDrawArrays(GL_QUADS, range->first, range->count);
+	}
+	glDisable(GL_TEXTURE_2D);
+	glDisableClientState(GL_COLOR_ARRAY);
+	glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+	glDisableClientState(GL_VERTEX_ARRAY);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+#endif
\ No newline at end of file
@@ -0,0 +1,41 @@
+// Asset packer, bakes the sprites of assetFiles into ASSET_PACK: decoded,
+// padded and packed into the texture atlas the way the game would at
+// startup, so the game only has to map the file. Run it again whenever the
+// sprites change, the game falls back to decoding them if the pack doesn't
+// match the sprites it expects.
+// usage: oofpack [FILE]
+
+#include <stdio.h>
+#define GL_GLEXT_PROTOTYPES
+#include <SDL2/SDL.h>
+#include <SDL2/SDL_opengl.h>
+#include "game.c"
+
+int main(int argc, char const *argv[])
+{
+	const char* filename = argc > 1 ? argv[1] : ASSET_PACK;
+	if (!IMG_Init(IMG_INIT_PNG))
+	{
+		printf("Unable to initialize SDL_Image\n");
+		return 1;
+	}
+
+	TextureAtlas atlas;
+	Texture textures[NUM_ASSETS];
+	packAssets(&atlas, textures);
+	int loaded = 0;
+	for (int i = 0; i < NUM_ASSETS; i++)
+	{
+		// regions of sprites that failed to load stay empty
+		if (textures[i].u1 > textures[i].u0)
+			loaded++;
+	}
+	if (loaded < NUM_ASSETS || !writeAssetPack(&atlas, textures, NUM_ASSETS, filename))
+	{
+		printf("Couldn't write %s.\n", filename);
+		return 1;
+	}
+	printf("Packed %d sprites into a %dx%d atlas in %s\n", NUM_ASSETS, atlas.width, atlas.height, filename);
+	IMG_Quit();
+	return 0;
+}
\ No newline at end of file
@@ -0,0 +1,252 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+// Uniform grid over the planets. Planets don't move, so unlike the ship grid
+// it is built once per game, over the bounding box of the planets with about
+// one planet per cell. Points outside the box still work, their queries just
+// start at the nearest cells.
+//
+// Cells can carry PLANET_GRID_GROUPS lower bounds of whatever the game ranks
+// planets by, negative for cells without a planet that counts, so searches
+// for the best planet can skip cells that can't beat the best one so far.
+
+#define PLANET_GRID_GROUPS 3
+
+struct PlanetGridEntry
+{
+	int index; // index of the planet
+	float x;
+	float y;
+	float radius;
+};
+
+struct PlanetGrid
+{
+	float originX;
+	float originY;
+	float cellSize;
+	int cols;
+	int rows;
+	float maxRadius;
+
+	// entries sorted by cell, ascending by index within a cell, cell c spans
+	// cellStart[c] .. cellStart[c + 1]
+	PlanetGridEntry *entries;
+	PlanetGridEntry *unsorted;
+	int numEntries;
+	int lenEntries;
+	int *cellStart;
+	int lenCells;
+
+	float *bound; // [cell * PLANET_GRID_GROUPS + group]
+	float minBound[PLANET_GRID_GROUPS]; // over all cells with planets that count, negative if none
+};
+
+// cursor for walking the planets in the cells overlapping a circle
+struct PlanetGridQuery
+{
+	PlanetGrid* grid;
+	int cx0, cx1, cy1;
+	int cx, cy;
+	int i, end;
+};
+
+inline int planetGridCellX(PlanetGrid* g, float x)
+{
+	int c = (int) floorf((x - g->originX) / g->cellSize);
+	return c < 0 ? 0 : (c >= g->cols ? g->cols - 1 : c);
+}
+
+inline int planetGridCellY(PlanetGrid* g, float y)
+{
+	int c = (int) floorf((y - g->originY) / g->cellSize);
+	return c < 0 ? 0 : (c >= g->rows ? g->rows - 1 : c);
+}
+
+// start a new build for count planets
+bool planetGridBegin(PlanetGrid* g, int count)
+{
+	g->numEntries = 0;
+	g->maxRadius = 0.f;
+	if (count > g->lenEntries)
+	{
+		bool success = true;
+		success &= growColumn((void**) &g->entries, count, sizeof(PlanetGridEntry));
+		success &= growColumn((void**) &g->unsorted, count, sizeof(PlanetGridEntry));
+		if (!success)
+		{
+			LOG_ERROR("Couldn't increase planet grid size.\n");
+			return false;
+		}
+		g->lenEntries = count;
+	}
+	return true;
+}
+
+void planetGridInsert(PlanetGrid* g, int index, Vectorf position, float radius)
+{
+	if (g->numEntries == g->lenEntries)
+		return;
+	PlanetGridEntry* e = &g->unsorted[g->numEntries];
+	g->numEntries++;
+	e->index = index;
+	e->x = position.x;
+	e->y = position.y;
+	e->radius = radius;
+	if (radius > g->maxRadius)
+		g->maxRadius = radius;
+}
+
+// sizes the grid to the inserted planets and sorts them into their cells
+bool planetGridFinish(PlanetGrid* g)
+{
+	float minx = g->numEntries > 0 ? g->unsorted[0].x : 0.f;
+	float miny = g->numEntries > 0 ? g->unsorted[0].y : 0.f;
+	float maxx = minx;
+	float maxy = miny;
+	for (int i = 1; i < g->numEntries; i++)
+	{
+		minx = fminf(minx, g->unsorted[i].x);
+		miny = fminf(miny, g->unsorted[i].y);
+		maxx = fmaxf(maxx, g->unsorted[i].x);
+		maxy = fmaxf(maxy, g->unsorted[i].y);
+	}
+	int side = (int) ceilf(sqrtf((float) g->numEntries));
+	if (side < 1)
+		side = 1;
+	float extent = fmaxf(maxx - minx, maxy - miny);
+	g->cellSize = extent > 0.f ? extent / side : 1.f;
+	g->originX = minx;
+	g->originY = miny;
+	// planets on the far edge go into the last cell
+	g->cols = (int) ceilf((maxx - minx) / g->cellSize);
+	g->rows = (int) ceilf((maxy - miny) / g->cellSize);
+	g->cols = g->cols < 1 ? 1 : (g->cols > side ? side : g->cols);
+	g->rows = g->rows < 1 ? 1 : (g->rows > side ? side : g->rows);
+
+	int cells = g->cols * g->rows;
+	if (cells + 1 > g->lenCells)
+	{
+		bool success = true;
+		success &= growColumn((void**) &g->cellStart, cells + 1, sizeof(int));
+		success &= growColumn((void**) &g->bound, cells * PLANET_GRID_GROUPS, sizeof(float));
+		if (!success)
+		{
+			LOG_ERROR("Couldn't increase planet grid cell count.\n");
+			g->cols = 0;
+			g->rows = 0;
+			return false;
+		}
+		g->lenCells = cells + 1;
+	}
+
+	// counting sort, keeps the index order inside a cell
+	int* start = g->cellStart;
+	memset(start, 0, (cells + 1) * sizeof(int));
+	for (int i = 0; i < g->numEntries; i++)
+		start[planetGridCellY(g, g->unsorted[i].y) * g->cols + planetGridCellX(g, g->unsorted[i].x) + 1]++;
+	for (int c = 0; c < cells; c++)
+		start[c + 1] += start[c];
+	for (int i = 0; i < g->numEntries; i++)
+	{
+		int c = planetGridCellY(g, g->unsorted[i].y) * g->cols + planetGridCellX(g, g->unsorted[i].x);
+		g->entries[start[c]] = g->unsorted[i];
+		start[c]++;
+	}
+	for (int c = cells; c > 0; c--)
+		start[c] = start[c - 1];
+	start[0] = 0;
+
+	for (int i = 0; i < cells * PLANET_GRID_GROUPS; i++)
+		g->bound[i] = -1.f;
+	for (int i = 0; i < PLANET_GRID_GROUPS; i++)
+		g->minBound[i] = -1.f;
+	return true;
+}
+
+// sets the bounds of every cell to the lowest of the values of its planets,
+// values[i * PLANET_GRID_GROUPS + group] for planet i, negative for planets that don't count
+void planetGridUpdateBounds(PlanetGrid* g, const float* values)
+{
+	for (int group = 0; group < PLANET_GRID_GROUPS; group++)
+		g->minBound[group] = -1.f;
+	for (int c = 0; c < g->cols * g->rows; c++)
+	{
+		for (int group = 0; group < PLANET_GRID_GROUPS; group++)
+		{
+			float bound = -1.f;
+			for (int i = g->cellStart[c]; i < g->cellStart[c + 1]; i++)
+			{
+				float v = values[g->entries[i].index * PLANET_GRID_GROUPS + group];
+				if (v >= 0.f && (bound < 0.f || v < bound))
+					bound = v;
+			}
+			g->bound[c * PLANET_GRID_GROUPS + group] = bound;
+			if (bound >= 0.f && (g->minBound[group] < 0.f || bound < g->minBound[group]))
+				g->minBound[group] = bound;
+		}
+	}
+}
+
+// lower bound of the distance from p to any planet center in cell (cx, cy),
+// on the safe side of float rounding
+float planetGridCellDistance(PlanetGrid* g, int cx, int cy, Vectorf p)
+{
+	float x0 = g->originX + cx * g->cellSize;
+	float y0 = g->originY + cy * g->cellSize;
+	float dx = fmaxf(fmaxf(x0 - p.x, p.x - (x0 + g->cellSize)), 0.f);
+	float dy = fmaxf(fmaxf(y0 - p.y, p.y - (y0 + g->cellSize)), 0.f);
+	float d = sqrtf(dx * dx + dy * dy);
+	return fmaxf(d * 0.999f - 0.001f * g->cellSize, 0.f);
+}
+
+// start walking the planets of all cells overlapping the circle around p,
+// planets outside of the circle aren't filtered out
+void planetGridQueryBegin(PlanetGridQuery* q, PlanetGrid* g, Vectorf p, float r)
+{
+	r = r * 1.001f + 0.001f * g->cellSize; // so rounding can't lose a planet on the edge
+	q->grid = g;
+	q->cx0 = planetGridCellX(g, p.x - r);
+	q->cx1 = planetGridCellX(g, p.x + r);
+	q->cy1 = planetGridCellY(g, p.y + r);
+	q->cx = q->cx0 - 1;
+	q->cy = planetGridCellY(g, p.y - r);
+	q->i = 0;
+	q->end = 0;
+	// circles entirely outside the grid only clamp onto its border cells
+	if (g->cols == 0 || p.x + r < g->originX || p.y + r < g->originY
+		|| p.x - r > g->originX + g->cols * g->cellSize || p.y - r > g->originY + g->rows * g->cellSize)
+		q->cy = q->cy1 + 1;
+}
+
+// returns the next planet entry or NULL once all cells are exhausted
+PlanetGridEntry* planetGridQueryNext(PlanetGridQuery* q)
+{
+	PlanetGrid* g = q->grid;
+	while (q->i >= q->end)
+	{
+		q->cx++;
+		if (q->cx > q->cx1)
+		{
+			q->cx = q->cx0;
+			q->cy++;
+		}
+		if (q->cy > q->cy1)
+			return NULL;
+		int c = q->cy * g->cols + q->cx;
+		q->i = g->cellStart[c];
+		q->end = g->cellStart[c + 1];
+	}
+	return &g->entries[q->i++];
+}
+
+void planetGridFree(PlanetGrid* g)
+{
+	free(g->entries);
+	free(g->unsorted);
+	free(g->cellStart);
+	free(g->bound);
+	memset(g, 0, sizeof(PlanetGrid));
+}
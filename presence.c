@@ -0,0 +1,328 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+// Approximate presence sums, i.e. sum of min(1 / r, 1) over all ships per
+// ship type, as seen from a point. Ships are binned into a square grid of
+// 2^depth by 2^depth cells over their bounding box, and the cells form a
+// quadtree whose nodes know the count, centroid and spread of each type. A
+// node that is far enough away counts as all its ships sitting in their
+// centroid, which is the Barnes-Hut approximation, near leaves are summed
+// exactly.
+//
+// With n ships within distance a of their centroid, a mean squared distance
+// of s2 to it and the centroid at distance d > a, the sum of 1 / r differs
+// from n / d by at most n * s2 / (d - a)^3, because the first order terms
+// cancel around the centroid and the second derivative of 1 / r is at most
+// 2 / r^3. A node is only summarized when that is within maxError of n / d
+// and no ship can be closer than 1 (where min(1 / r, 1) would clamp), so the
+// whole sum is off by at most maxError relative, except for float rounding.
+//
+// Points are sorted by the Morton order of their cell, so the points of any
+// node are one contiguous range and no node needs to store its children.
+
+#define PRESENCE_GROUPS 3
+#define PRESENCE_MAX_DEPTH 8
+#define PRESENCE_LEAF_SIZE 32 // aim for about this many points per leaf
+
+struct PresenceNode
+{
+	float count[PRESENCE_GROUPS];
+	float cx[PRESENCE_GROUPS]; // centroids
+	float cy[PRESENCE_GROUPS];
+	float spread[PRESENCE_GROUPS]; // bound on the distance of a ship to its centroid
+	float meanSqr[PRESENCE_GROUPS]; // mean squared distance of the ships to their centroid
+};
+
+struct PresenceTree
+{
+	int depth;
+	float minx;
+	float miny;
+	float cellSize;
+
+	// level l starts at node (4^l - 1) / 3 and holds 4^l nodes in Morton order
+	PresenceNode *nodes;
+	int lenNodes;
+
+	// points of leaf m are cellStart[m] .. cellStart[m + 1]
+	int *cellStart;
+	int lenCells;
+
+	// copy of the points sorted by leaf
+	float *x;
+	float *y;
+	int *group;
+	int *cell;
+	int numPoints;
+	int lenPoints;
+};
+
+// interleaves the bits of x and y, both below 2^PRESENCE_MAX_DEPTH
+inline int presenceMorton(int x, int y)
+{
+	int m = 0;
+	for (int b = 0; b < PRESENCE_MAX_DEPTH; b++)
+		m |= ((x >> b) & 1) << (2 * b) | ((y >> b) & 1) << (2 * b + 1);
+	return m;
+}
+
+inline int presenceLevelStart(int level)
+{
+	return ((1 << (2 * level)) - 1) / 3;
+}
+
+inline int presenceCell(float v, float origin, float cellSize, int maxCell)
+{
+	int c = (int) ((v - origin) / cellSize);
+	return c < maxCell ? c : maxCell;
+}
+
+// rebuilds the tree from n points, group[i] must be below PRESENCE_GROUPS
+void presenceTreeBuild(PresenceTree* tree, const float* x, const float* y, const int* group, int n)
+{
+	tree->numPoints = 0;
+	if (n == 0)
+		return;
+
+	int depth = 0;
+	while (depth < PRESENCE_MAX_DEPTH && (1 << (2 * depth + 2)) * PRESENCE_LEAF_SIZE <= n)
+		depth++;
+	int numCells = 1 << (2 * depth);
+	int numNodes = presenceLevelStart(depth + 1);
+
+	if (n > tree->lenPoints)
+	{
+		int len = grownLength(tree->lenPoints, n);
+		bool success = true;
+		success &= growColumn((void**) &tree->x, len, sizeof(float));
+		success &= growColumn((void**) &tree->y, len, sizeof(float));
+		success &= growColumn((void**) &tree->group, len, sizeof(int));
+		success &= growColumn((void**) &tree->cell, len, sizeof(int));
+		if (!success)
+		{
+			LOG_ERROR("Couldn't increase presence tree size, leaving it empty.\n");
+			return;
+		}
+		tree->lenPoints = len;
+	}
+	if (numNodes > tree->lenNodes || numCells + 1 > tree->lenCells)
+	{
+		bool success = true;
+		success &= growColumn((void**) &tree->nodes, numNodes, sizeof(PresenceNode));
+		success &= growColumn((void**) &tree->cellStart, numCells + 1, sizeof(int));
+		if (!success)
+		{
+			LOG_ERROR("Couldn't increase presence tree size, leaving it empty.\n");
+			return;
+		}
+		tree->lenNodes = numNodes;
+		tree->lenCells = numCells + 1;
+	}
+	tree->depth = depth;
+
+	float minx = x[0], maxx = x[0], miny = y[0], maxy = y[0];
+	for (int i = 1; i < n; i++)
+	{
+		minx = fminf(minx, x[i]);
+		maxx = fmaxf(maxx, x[i]);
+		miny = fminf(miny, y[i]);
+		maxy = fmaxf(maxy, y[i]);
+	}
+	float size = fmaxf(fmaxf(maxx - minx, maxy - miny), 1.f);
+	tree->minx = minx;
+	tree->miny = miny;
+	tree->cellSize = size / (1 << depth);
+
+	// counting sort by leaf, keeps the order of the points inside a leaf
+	int* start = tree->cellStart;
+	memset(start, 0, (numCells + 1) * sizeof(int));
+	int maxCell = (1 << depth) - 1;
+	for (int i = 0; i < n; i++)
+	{
+		int cx = presenceCell(x[i], minx, tree->cellSize, maxCell);
+		int cy = presenceCell(y[i], miny, tree->cellSize, maxCell);
+		tree->cell[i] = presenceMorton(cx, cy);
+		start[tree->cell[i] + 1]++;
+	}
+	for (int c = 0; c < numCells; c++)
+		start[c + 1] += start[c];
+	for (int i = 0; i < n; i++)
+	{
+		int j = start[tree->cell[i]];
+		start[tree->cell[i]]++;
+		tree->x[j] = x[i];
+		tree->y[j] = y[i];
+		tree->group[j] = group[i];
+	}
+	// the placement loop shifted every start to the next cell, shift back
+	for (int c = numCells; c > 0; c--)
+		start[c] = start[c - 1];
+	start[0] = 0;
+	tree->numPoints = n;
+
+	// leaves, centroids first and then the spread around them
+	PresenceNode* leaves = &tree->nodes[presenceLevelStart(depth)];
+	for (int c = 0; c < numCells; c++)
+	{
+		PresenceNode* node = &leaves[c];
+		for (int g = 0; g < PRESENCE_GROUPS; g++)
+		{
+			node->count[g] = 0.f;
+			node->cx[g] = 0.f;
+			node->cy[g] = 0.f;
+			node->spread[g] = 0.f;
+			node->meanSqr[g] = 0.f;
+		}
+		for (int i = start[c]; i < start[c + 1]; i++)
+		{
+			int g = tree->group[i];
+			node->count[g] += 1.f;
+			node->cx[g] += tree->x[i];
+			node->cy[g] += tree->y[i];
+		}
+		for (int g = 0; g < PRESENCE_GROUPS; g++)
+		{
+			if (node->count[g] > 0.f)
+			{
+				node->cx[g] /= node->count[g];
+				node->cy[g] /= node->count[g];
+			}
+		}
+		for (int i = start[c]; i < start[c + 1]; i++)
+		{
+			int g = tree->group[i];
+			float dx = tree->x[i] - node->cx[g];
+			float dy = tree->y[i] - node->cy[g];
+			node->spread[g] = fmaxf(node->spread[g], dx * dx + dy * dy);
+			node->meanSqr[g] += dx * dx + dy * dy;
+		}
+		for (int g = 0; g < PRESENCE_GROUPS; g++)
+		{
+			node->spread[g] = sqrtf(node->spread[g]);
+			if (node->count[g] > 0.f)
+				node->meanSqr[g] /= node->count[g];
+		}
+	}
+
+	// inner nodes from their children, the farthest child bounds the spread
+	// and the mean squares combine exactly (parallel axis theorem)
+	for (int level = depth - 1; level >= 0; level--)
+	{
+		PresenceNode* nodes = &tree->nodes[presenceLevelStart(level)];
+		PresenceNode* children = &tree->nodes[presenceLevelStart(level + 1)];
+		for (int m = 0; m < (1 << (2 * level)); m++)
+		{
+			PresenceNode* node = &nodes[m];
+			for (int g = 0; g < PRESENCE_GROUPS; g++)
+			{
+				float count = 0.f;
+				float sx = 0.f;
+				float sy = 0.f;
+				for (int c = 0; c < 4; c++)
+				{
+					PresenceNode* child = &children[4 * m + c];
+					count += child->count[g];
+					sx += child->cx[g] * child->count[g];
+					sy += child->cy[g] * child->count[g];
+				}
+				node->count[g] = count;
+				node->cx[g] = count > 0.f ? sx / count : 0.f;
+				node->cy[g] = count > 0.f ? sy / count : 0.f;
+
+				float spread = 0.f;
+				float sqr = 0.f;
+				for (int c = 0; c < 4; c++)
+				{
+					PresenceNode* child = &children[4 * m + c];
+					if (child->count[g] == 0.f)
+						continue;
+					float dx = child->cx[g] - node->cx[g];
+					float dy = child->cy[g] - node->cy[g];
+					spread = fmaxf(spread, sqrtf(dx * dx + dy * dy) + child->spread[g]);
+					sqr += child->count[g] * (child->meanSqr[g] + dx * dx + dy * dy);
+				}
+				node->spread[g] = spread;
+				node->meanSqr[g] = count > 0.f ? sqr / count : 0.f;
+			}
+		}
+	}
+}
+
+// whether all groups of the node can be summarized as seen from (px, py)
+bool presenceNodeIsFar(PresenceNode* node, float px, float py, float maxError)
+{
+	for (int g = 0; g < PRESENCE_GROUPS; g++)
+	{
+		if (node->count[g] == 0.f)
+			continue;
+		float a = node->spread[g];
+		float dx = node->cx[g] - px;
+		float dy = node->cy[g] - py;
+		float d = sqrtf(dx * dx + dy * dy);
+		if (d - a <= 1.f || node->meanSqr[g] * d > maxError * (d - a) * (d - a) * (d - a))
+			return false;
+	}
+	return true;
+}
+
+// adds the approximate presence at (px, py) to sums, maxError is the allowed relative error
+void presenceTreeSum(PresenceTree* tree, float px, float py, float maxError, float* sums)
+{
+	if (tree->numPoints == 0)
+		return;
+
+	// depth first, every level leaves at most three siblings on the stack
+	int stackLevel[3 * PRESENCE_MAX_DEPTH + 4];
+	int stackNode[3 * PRESENCE_MAX_DEPTH + 4];
+	int top = 0;
+	stackLevel[top] = 0;
+	stackNode[top] = 0;
+	top++;
+	while (top > 0)
+	{
+		top--;
+		int level = stackLevel[top];
+		int m = stackNode[top];
+		int shift = 2 * (tree->depth - level);
+		int begin = tree->cellStart[m << shift];
+		int end = tree->cellStart[(m + 1) << shift];
+		if (begin == end)
+			continue;
+
+		PresenceNode* node = &tree->nodes[presenceLevelStart(level) + m];
+		if (presenceNodeIsFar(node, px, py, maxError))
+		{
+			for (int g = 0; g < PRESENCE_GROUPS; g++)
+			{
+				if (node->count[g] == 0.f)
+					continue;
+				float dx = node->cx[g] - px;
+				float dy = node->cy[g] - py;
+				sums[g] += node->count[g] / sqrtf(dx * dx + dy * dy);
+			}
+		} else if (level == tree->depth) {
+			batchInverseDistanceSum(tree->x + begin, tree->y + begin, tree->group + begin,
+				end - begin, px, py, sums, PRESENCE_GROUPS);
+		} else {
+			for (int c = 0; c < 4; c++)
+			{
+				stackLevel[top] = level + 1;
+				stackNode[top] = 4 * m + c;
+				top++;
+			}
+		}
+	}
+}
+
+void presenceTreeFree(PresenceTree* tree)
+{
+	free(tree->nodes);
+	free(tree->cellStart);
+	free(tree->x);
+	free(tree->y);
+	free(tree->group);
+	free(tree->cell);
+	memset(tree, 0, sizeof(PresenceTree));
+}
\ No newline at end of file
@@ -0,0 +1,312 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+// monotonic time in seconds
+double monotonicTime()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Instrumentation zones, only compiled in with -DPROFILE. Every zone that
+// ends is recorded into a preallocated ring buffer of its thread, which can
+// be written out as Chrome trace event JSON (load it in chrome://tracing or
+// ui.perfetto.dev), and added to a per frame total for the on screen overlay.
+//
+//	void f()
+//	{
+//		PROFILE_ZONE("f");
+//		...
+//	}
+//
+// Zones can be used by the window and the simulation thread, each thread
+// shows up as its own row in the trace (see PROFILE_THREAD). The jobs run
+// inside the zones of the thread that started them.
+//
+// A thread only takes the lock of its own buffer to record, which nobody
+// else holds except while the frame times or the trace are collected.
+
+#ifdef PROFILE
+
+#define PROFILE_RING_SIZE 65536 // per thread
+#define PROFILE_MAX_ZONES 32
+#define PROFILE_MAX_THREADS 8
+
+struct ProfileEvent
+{
+	const char* name;
+	double start;
+	double end;
+	int thread;
+};
+
+struct ProfileBuffer
+{
+	ProfileEvent events[PROFILE_RING_SIZE];
+	long long numEvents; // total ever recorded, the ring holds the last PROFILE_RING_SIZE
+	double frameTime[PROFILE_MAX_ZONES]; // seconds since profileEndFrame last collected them
+	pthread_mutex_t lock;
+};
+
+struct Profiler
+{
+	ProfileBuffer* buffers[PROFILE_MAX_THREADS];
+	int numBuffers;
+
+	const char* zoneNames[PROFILE_MAX_ZONES];
+	double averageTime[PROFILE_MAX_ZONES]; // smoothed seconds per frame
+	int numZones;
+
+	bool overlay;
+};
+
+Profiler profiler;
+pthread_mutex_t profilerLock = PTHREAD_MUTEX_INITIALIZER; // all of profiler, the buffers have their own
+__thread int profileThread = 0;
+__thread ProfileBuffer* profileBuffer = NULL;
+__thread bool profileUnbuffered = false; // the thread didn't get a buffer, its zones aren't recorded
+
+// zones are told apart by their name pointer, so names must be string
+// constants, look them up once and keep the id (see PROFILE_ZONE)
+int profileZone(const char* name)
+{
+	pthread_mutex_lock(&profilerLock);
+	int zone = -1;
+	for (int i = 0; i < profiler.numZones; i++)
+	{
+		if (profiler.zoneNames[i] == name)
+			zone = i;
+	}
+	if (zone < 0 && profiler.numZones < PROFILE_MAX_ZONES)
+	{
+		zone = profiler.numZones;
+		profiler.zoneNames[zone] = name;
+		profiler.averageTime[zone] = 0.0;
+		profiler.numZones++;
+	}
+	pthread_mutex_unlock(&profilerLock);
+	return zone;
+}
+
+// the buffer of the calling thread, NULL if there are too many threads
+ProfileBuffer* profileThreadBuffer()
+{
+	if (profileBuffer || profileUnbuffered)
+		return profileBuffer;
+	pthread_mutex_lock(&profilerLock);
+	if (profiler.numBuffers < PROFILE_MAX_THREADS)
+	{
+		ProfileBuffer* buffer = (ProfileBuffer*) calloc(1, sizeof(ProfileBuffer));
+		if (buffer)
+		{
+			pthread_mutex_init(&buffer->lock, NULL);
+			profiler.buffers[profiler.numBuffers++] = buffer;
+			profileBuffer = buffer;
+		}
+	}
+	pthread_mutex_unlock(&profilerLock);
+	if (!profileBuffer)
+	{
+		LOG_ERROR("Couldn't profile thread %d, there are too many.\n", profileThread);
+		profileUnbuffered = true;
+	}
+	return profileBuffer;
+}
+
+void profileRecord(int zone, const char* name, double start, double end)
+{
+	ProfileBuffer* buffer = profileThreadBuffer();
+	if (!buffer)
+		return;
+	pthread_mutex_lock(&buffer->lock);
+	ProfileEvent* e = &buffer->events[buffer->numEvents % PROFILE_RING_SIZE];
+	buffer->numEvents++;
+	e->name = name;
+	e->start = start;
+	e->end = end;
+	e->thread = profileThread;
+	if (zone >= 0)
+		buffer->frameTime[zone] += end - start;
+	pthread_mutex_unlock(&buffer->lock);
+}
+
+struct ProfileScope
+{
+	int zone;
+	const char* name;
+	double start;
+
+	ProfileScope(int zone, const char* name) : zone(zone), name(name), start(monotonicTime()) {}
+	~ProfileScope()
+	{
+		profileRecord(zone, name, start, monotonicTime());
+	}
+};
+
+// zone ids of a table of names, for PROFILE_RECORD
+struct ProfileZoneTable
+{
+	int zones[PROFILE_MAX_ZONES];
+
+	ProfileZoneTable(const char* const* names, int count)
+	{
+		for (int i = 0; i < count && i < PROFILE_MAX_ZONES; i++)
+			zones[i] = profileZone(names[i]);
+	}
+};
+
+// folds the zone times of all threads since the last call into the averages shown by the overlay
+void profileEndFrame()
+{
+	double frameTime[PROFILE_MAX_ZONES];
+	memset(frameTime, 0, sizeof(frameTime));
+	pthread_mutex_lock(&profilerLock);
+	for (int b = 0; b < profiler.numBuffers; b++)
+	{
+		ProfileBuffer* buffer = profiler.buffers[b];
+		pthread_mutex_lock(&buffer->lock);
+		for (int i = 0; i < PROFILE_MAX_ZONES; i++)
+		{
+			frameTime[i] += buffer->frameTime[i];
+			buffer->frameTime[i] = 0.0;
+		}
+		pthread_mutex_unlock(&buffer->lock);
+	}
+	for (int i = 0; i < profiler.numZones; i++)
+		profiler.averageTime[i] = profiler.averageTime[i] * 0.9 + frameTime[i] * 0.1;
+	pthread_mutex_unlock(&profilerLock);
+}
+
+// writes the events still in the ring buffers as Chrome trace event JSON
+bool profileWriteTrace(const char* filename)
+{
+	// copy the events out first, so the threads don't wait for the file
+	ProfileEvent* events = (ProfileEvent*) malloc(sizeof(ProfileEvent) * PROFILE_RING_SIZE * PROFILE_MAX_THREADS);
+	if (!events)
+	{
+		LOG_ERROR("Couldn't allocate the trace events.\n");
+		return false;
+	}
+	long long numEvents = 0;
+	pthread_mutex_lock(&profilerLock);
+	for (int b = 0; b < profiler.numBuffers; b++)
+	{
+		ProfileBuffer* buffer = profiler.buffers[b];
+		pthread_mutex_lock(&buffer->lock);
+		long long first = buffer->numEvents > PROFILE_RING_SIZE ? buffer->numEvents - PROFILE_RING_SIZE : 0;
+		for (long long i = first; i < buffer->numEvents; i++)
+			events[numEvents++] = buffer->events[i % PROFILE_RING_SIZE];
+		pthread_mutex_unlock(&buffer->lock);
+	}
+	pthread_mutex_unlock(&profilerLock);
+
+	FILE* file = fopen(filename, "w");
+	if (!file)
+	{
+		LOG_ERROR("Couldn't open %s for writing.\n", filename);
+		free(events);
+		return false;
+	}
+	double origin = numEvents > 0 ? events[0].start : 0.0;
+	for (long long i = 1; i < numEvents; i++)
+	{
+		if (events[i].start < origin)
+			origin = events[i].start;
+	}
+	fprintf(file, "{\"traceEvents\":[\n");
+	for (long long i = 0; i < numEvents; i++)
+	{
+		ProfileEvent* e = &events[i];
+		fprintf(file, "{\"name\":\"%s\",\"ph\":\"X\",\"pid\":0,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}%s\n",
+			e->name, e->thread, (e->start - origin) * 1e6, (e->end - e->start) * 1e6, i + 1 < numEvents ? "," : "");
+	}
+	fprintf(file, "],\"displayTimeUnit\":\"ms\"}\n");
+	fclose(file);
+	free(events);
+	LOG_INFO("Wrote %lld trace events to %s\n", numEvents, filename);
+	return true;
+}
+
+#ifndef HEADLESS
+// one bar per zone in ui coordinates, the full width is a 60 fps frame
+void renderProfileOverlay()
+{
+	if (!profiler.overlay)
+		return;
+
+	float frame = 1.f / 60.f;
+	float rowHeight = 0.02f;
+	float top = 0.05f;
+	pthread_mutex_lock(&profilerLock);
+	glEnable(GL_BLEND);
+	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	glColor4f(0.f, 0.f, 0.f, 0.5f);
+	glBegin(GL_QUADS);
+		glVertex2f(0.f, top);
+		glVertex2f(1.f, top);
+		glVertex2f(1.f, top + rowHeight * profiler.numZones);
+		glVertex2f(0.f, top + rowHeight * profiler.numZones);
+	glEnd();
+	glDisable(GL_BLEND);
+
+	glBegin(GL_QUADS);
+	for (int i = 0; i < profiler.numZones; i++)
+	{
+		float w = profiler.averageTime[i] / frame;
+		if (w > 1.f)
+			w = 1.f;
+		float y = top + rowHeight * i;
+		// alternate colors so neighbouring rows can be told apart
+		if (i % 2 == 0)
+			glColor3f(1.f, 0.6f, 0.f);
+		else
+			glColor3f(0.f, 0.6f, 1.f);
+		glVertex2f(0.f, y + rowHeight * 0.1f);
+		glVertex2f(w, y + rowHeight * 0.1f);
+		glVertex2f(w, y + rowHeight * 0.9f);
+		glVertex2f(0.f, y + rowHeight * 0.9f);
+	}
+	glEnd();
+	pthread_mutex_unlock(&profilerLock);
+}
+#endif
+
+void toggleProfileOverlay()
+{
+	profiler.overlay = !profiler.overlay;
+	if (!profiler.overlay)
+		return;
+	// there is no text rendering, so name the rows on the console instead
+	LOG_INFO("profile overlay rows, full width is 16.7 ms:\n");
+	pthread_mutex_lock(&profilerLock);
+	for (int i = 0; i < profiler.numZones; i++)
+		LOG_INFO("%2d %-12s %8.3f ms\n", i, profiler.zoneNames[i], profiler.averageTime[i] * 1000.0);
+	pthread_mutex_unlock(&profilerLock);
+}
+
+#define PROFILE_CONCAT2(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT2(a, b)
+#define PROFILE_ZONE(name) \
+	static int PROFILE_CONCAT(profileZoneId, __LINE__) = profileZone(name); \
+	ProfileScope PROFILE_CONCAT(profileScope, __LINE__)(PROFILE_CONCAT(profileZoneId, __LINE__), name)
+// records [start, end) as the zone names[index], names has to be an array of string constants
+#define PROFILE_RECORD(names, index, start, end) \
+	do { \
+		static ProfileZoneTable profileTable(names, sizeof(names) / sizeof(names[0])); \
+		profileRecord(profileTable.zones[index], names[index], start, end); \
+	} while (0)
+#define PROFILE_END_FRAME() profileEndFrame()
+#define PROFILE_THREAD(id) profileThread = (id)
+
+#else
+
+#define PROFILE_ZONE(name)
+#define PROFILE_RECORD(names, index, start, end)
+#define PROFILE_END_FRAME()
+#define PROFILE_THREAD(id)
+
+#endif
\ No newline at end of file
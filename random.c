@@ -0,0 +1,71 @@
+#include <stdint.h>
+
+// Counter based random numbers. A stream is keyed by the game seed, what the
+// numbers are for, the entity they belong to and the tick, every draw hashes
+// the key with a counter. No state is shared between streams, so a draw
+// doesn't depend on the order entities are processed in or on the thread
+// doing it, and nothing besides the seed needs to be saved.
+//
+//	RandomStream r = randomStream(game.seed, rng_wave, type, game.tickCount);
+//	Vectorf p = randomBetween(&r, p1, p2);
+//
+// The hash is the SplitMix64 finalizer, so a stream is a SplitMix64 sequence
+// starting at the hashed key. It is a lot faster than rand(), which takes a lock.
+
+// purposes, streams with different purposes never share numbers
+#define rng_planet_seed 0
+#define rng_planet 1
+#define rng_wave 2
+#define rng_shipyard 3
+#define rng_bench 4
+
+#define RANDOM_GAMMA 0x9e3779b97f4a7c15ull
+
+struct RandomStream
+{
+	uint64_t key;
+	uint64_t counter;
+};
+
+inline uint64_t randomMix(uint64_t x)
+{
+	x ^= x >> 30;
+	x *= 0xbf58476d1ce4e5b9ull;
+	x ^= x >> 27;
+	x *= 0x94d049bb133111ebull;
+	x ^= x >> 31;
+	return x;
+}
+
+inline RandomStream randomStream(uint32_t seed, uint32_t purpose, uint64_t entity = 0, uint64_t tick = 0)
+{
+	RandomStream r;
+	r.key = randomMix(((uint64_t) seed << 32 | purpose) + RANDOM_GAMMA);
+	r.key = randomMix(r.key ^ entity);
+	r.key = randomMix(r.key ^ tick);
+	r.counter = 0;
+	return r;
+}
+
+// 32 random bits
+inline uint32_t randomInt(RandomStream* r)
+{
+	r->counter++;
+	return randomMix(r->key + r->counter * RANDOM_GAMMA) >> 32;
+}
+
+// in [0, 1)
+inline float randomFloat(RandomStream* r)
+{
+	return (randomInt(r) >> 8) * (1.f / 16777216.f);
+}
+
+inline Vectorf randomBetween(RandomStream* r, Vectorf v1, Vectorf v2)
+{
+	Vectorf v;
+	v.x = v1.x + (v2.x - v1.x) * randomFloat(r);
+	v.y = v1.y + (v2.y - v1.y) * randomFloat(r);
+	v.z = v1.z + (v2.z - v1.z) * randomFloat(r);
+	v.w = v1.w + (v2.w - v1.w) * randomFloat(r);
+	return v;
+}
\ No newline at end of file
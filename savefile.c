@@ -0,0 +1,265 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#if defined(WIN32) || defined(_WIN32)
+	#define SAVEFILE_NO_MMAP
+#else
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <fcntl.h>
+	#include <unistd.h>
+#endif
+
+// Binary save files. A save file starts with a header naming the format
+// version and the byte order it was written with, followed by plain blocks
+// of memory, mostly whole columns. There are no pointers in the file, they
+// are written as indices or counts.
+//
+// Other files use the same layout with their own magic, like the asset pack
+// (see textures.c).
+//
+// Writing goes through stdio. Reading maps the whole file and copies the
+// blocks out of it with a bounds checked cursor, so a truncated or garbled
+// file fails the load instead of reading past the end.
+
+#define SAVEFILE_MAGIC 0x5346464f // "OOFS" when read as little endian bytes
+#define SAVEFILE_BYTE_ORDER 0x01020304
+
+struct SaveHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t byteOrder; // reads back differently on a machine with the other byte order
+	uint32_t size; // of the whole file, files past 4 GB can't be written
+};
+
+struct SaveWriter
+{
+	FILE* file;
+	size_t size; // bytes written so far
+	bool failed;
+};
+
+struct SaveReader
+{
+	const unsigned char* data;
+	size_t size;
+	size_t pos;
+	bool failed;
+};
+
+bool openSaveWriter(SaveWriter* writer, const char* filename)
+{
+	writer->file = fopen(filename, "wb");
+	writer->size = 0;
+	writer->failed = writer->file == NULL;
+	if (writer->failed)
+		LOG_ERROR("Couldn't open %s for writing.\n", filename);
+	return !writer->failed;
+}
+
+void saveWrite(SaveWriter* writer, const void* data, size_t size)
+{
+	if (writer->failed || size == 0)
+		return;
+	if (fwrite(data, 1, size, writer->file) != size)
+		writer->failed = true;
+	writer->size += size;
+}
+
+inline void saveWriteInt(SaveWriter* writer, int value)
+{
+	saveWrite(writer, &value, sizeof(int));
+}
+
+inline void saveWriteFloat(SaveWriter* writer, float value)
+{
+	saveWrite(writer, &value, sizeof(float));
+}
+
+// writes the header with the final size, closes the file and returns true if everything was written
+bool closeSaveWriter(SaveWriter* writer, uint32_t version, uint32_t magic = SAVEFILE_MAGIC)
+{
+	if (!writer->file)
+		return false;
+	SaveHeader header;
+	header.magic = magic;
+	header.version = version;
+	header.byteOrder = SAVEFILE_BYTE_ORDER;
+	header.size = (uint32_t) writer->size;
+	if (writer->size > UINT32_MAX)
+		writer->failed = true;
+	if (!writer->failed && fseek(writer->file, 0, SEEK_SET) == 0)
+	{
+		if (fwrite(&header, sizeof(header), 1, writer->file) != 1)
+			writer->failed = true;
+	} else {
+		writer->failed = true;
+	}
+	if (fclose(writer->file) != 0)
+		writer->failed = true;
+	writer->file = NULL;
+	return !writer->failed;
+}
+
+// leaves room for the header, which is only written by closeSaveWriter
+inline void saveWriteHeader(SaveWriter* writer)
+{
+	SaveHeader header;
+	memset(&header, 0, sizeof(header));
+	saveWrite(writer, &header, sizeof(header));
+}
+
+bool openSaveReader(SaveReader* reader, const char* filename)
+{
+	memset(reader, 0, sizeof(SaveReader));
+	reader->failed = true;
+#ifdef SAVEFILE_NO_MMAP
+	FILE* file = fopen(filename, "rb");
+	if (!file)
+	{
+		LOG_ERROR("Couldn't open %s for reading.\n", filename);
+		return false;
+	}
+	fseek(file, 0, SEEK_END);
+	long size = ftell(file);
+	fseek(file, 0, SEEK_SET);
+	unsigned char* data = size > 0 ? (unsigned char*) malloc(size) : NULL;
+	if (!data || fread(data, 1, size, file) != (size_t) size)
+	{
+		LOG_ERROR("Couldn't read %s.\n", filename);
+		free(data);
+		fclose(file);
+		return false;
+	}
+	fclose(file);
+	reader->data = data;
+	reader->size = size;
+#else
+	int fd = open(filename, O_RDONLY);
+	if (fd < 0)
+	{
+		LOG_ERROR("Couldn't open %s for reading.\n", filename);
+		return false;
+	}
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size == 0)
+	{
+		LOG_ERROR("Couldn't read %s.\n", filename);
+		close(fd);
+		return false;
+	}
+	void* data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd); // the mapping stays valid
+	if (data == MAP_FAILED)
+	{
+		LOG_ERROR("Couldn't map %s.\n", filename);
+		return false;
+	}
+	reader->data = (const unsigned char*) data;
+	reader->size = st.st_size;
+#endif
+	reader->failed = false;
+	return true;
+}
+
+// copies the next size bytes to data, or zeroes data and fails the reader if the file is too short
+void saveRead(SaveReader* reader, void* data, size_t size)
+{
+	if (reader->failed || size > reader->size - reader->pos)
+	{
+		reader->failed = true;
+		memset(data, 0, size);
+		return;
+	}
+	memcpy(data, reader->data + reader->pos, size);
+	reader->pos += size;
+}
+
+// the next size bytes in place, NULL and fails the reader if the file is too
+// short, stays valid until the reader is closed
+const unsigned char* saveReadBlock(SaveReader* reader, size_t size)
+{
+	if (reader->failed || size > reader->size - reader->pos)
+	{
+		reader->failed = true;
+		return NULL;
+	}
+	const unsigned char* data = reader->data + reader->pos;
+	reader->pos += size;
+	return data;
+}
+
+inline int saveReadInt(SaveReader* reader)
+{
+	int value;
+	saveRead(reader, &value, sizeof(int));
+	return value;
+}
+
+inline float saveReadFloat(SaveReader* reader)
+{
+	float value;
+	saveRead(reader, &value, sizeof(float));
+	return value;
+}
+
+// reads a count and fails the reader unless 0 <= count <= limit
+int saveReadCount(SaveReader* reader, int limit)
+{
+	int count = saveReadInt(reader);
+	if (count < 0 || count > limit)
+	{
+		reader->failed = true;
+		return 0;
+	}
+	return count;
+}
+
+// fails the reader unless the rest of the file holds count records of size
+// bytes, so a damaged count is caught before anything is allocated for it
+bool saveReadFits(SaveReader* reader, int count, size_t size)
+{
+	if (reader->failed || (size_t) count * size > reader->size - reader->pos)
+		reader->failed = true;
+	return !reader->failed;
+}
+
+// checks the header, returns the version of the file or 0 if it isn't one of ours
+uint32_t saveReadHeader(SaveReader* reader, uint32_t magic = SAVEFILE_MAGIC)
+{
+	SaveHeader header;
+	saveRead(reader, &header, sizeof(header));
+	if (reader->failed || header.magic != magic)
+	{
+		LOG_ERROR("Couldn't load save file, it isn't one.\n");
+		reader->failed = true;
+		return 0;
+	}
+	if (header.byteOrder != SAVEFILE_BYTE_ORDER)
+	{
+		LOG_ERROR("Couldn't load save file, it was written with a different byte order.\n");
+		reader->failed = true;
+		return 0;
+	}
+	if (header.size != reader->size)
+	{
+		LOG_ERROR("Couldn't load save file, it is %zu bytes instead of %u.\n", reader->size, header.size);
+		reader->failed = true;
+		return 0;
+	}
+	return header.version;
+}
+
+void closeSaveReader(SaveReader* reader)
+{
+	if (!reader->data)
+		return;
+#ifdef SAVEFILE_NO_MMAP
+	free((void*) reader->data);
+#else
+	munmap((void*) reader->data, reader->size);
+#endif
+	reader->data = NULL;
+}
\ No newline at end of file
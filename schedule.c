@@ -0,0 +1,124 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Queue of timed events, a binary min heap ordered by time, then by the
+// planet and tile they belong to, so events due at the same time always come
+// out in the same order. Times are whole seconds of game time.
+
+struct ScheduledEvent
+{
+	int time;
+	int planet;
+	int tile;
+};
+
+struct Schedule
+{
+	ScheduledEvent *events;
+	int num;
+	int len;
+};
+
+inline bool scheduleBefore(ScheduledEvent* a, ScheduledEvent* b)
+{
+	if (a->time != b->time)
+		return a->time < b->time;
+	if (a->planet != b->planet)
+		return a->planet < b->planet;
+	return a->tile < b->tile;
+}
+
+void scheduleSiftUp(Schedule* s, int i)
+{
+	ScheduledEvent e = s->events[i];
+	while (i > 0)
+	{
+		int parent = (i - 1) / 2;
+		if (!scheduleBefore(&e, &s->events[parent]))
+			break;
+		s->events[i] = s->events[parent];
+		i = parent;
+	}
+	s->events[i] = e;
+}
+
+void scheduleSiftDown(Schedule* s, int i)
+{
+	ScheduledEvent e = s->events[i];
+	while (true)
+	{
+		int child = 2 * i + 1;
+		if (child >= s->num)
+			break;
+		if (child + 1 < s->num && scheduleBefore(&s->events[child + 1], &s->events[child]))
+			child++;
+		if (!scheduleBefore(&s->events[child], &e))
+			break;
+		s->events[i] = s->events[child];
+		i = child;
+	}
+	s->events[i] = e;
+}
+
+bool schedulePush(Schedule* s, int time, int planet, int tile)
+{
+	if (s->num == s->len)
+	{
+		int len = grownLength(s->len, s->num + 1, 64);
+		if (!growColumn((void**) &s->events, len, sizeof(ScheduledEvent)))
+		{
+			LOG_ERROR("Couldn't increase schedule size, dropping event.\n");
+			return false;
+		}
+		s->len = len;
+	}
+	s->events[s->num] = {time, planet, tile};
+	s->num++;
+	scheduleSiftUp(s, s->num - 1);
+	return true;
+}
+
+// takes the first event if it is due at or before time
+bool schedulePop(Schedule* s, int time, ScheduledEvent* e)
+{
+	if (s->num == 0 || s->events[0].time > time)
+		return false;
+	*e = s->events[0];
+	s->num--;
+	if (s->num > 0)
+	{
+		s->events[0] = s->events[s->num];
+		scheduleSiftDown(s, 0);
+	}
+	return true;
+}
+
+// removes the event of a tile, if there is one
+void scheduleRemove(Schedule* s, int planet, int tile)
+{
+	for (int i = 0; i < s->num; i++)
+	{
+		if (s->events[i].planet != planet || s->events[i].tile != tile)
+			continue;
+		s->num--;
+		if (i < s->num)
+		{
+			s->events[i] = s->events[s->num];
+			scheduleSiftDown(s, i);
+			scheduleSiftUp(s, i);
+		}
+		return;
+	}
+}
+
+inline void scheduleClear(Schedule* s)
+{
+	s->num = 0;
+}
+
+void scheduleFree(Schedule* s)
+{
+	free(s->events);
+	memset(s, 0, sizeof(Schedule));
+}
@@ -0,0 +1,241 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Ships are stored as structure of arrays, one contiguous column per value.
+// The hot loops only touch the columns they need, e.g. the presence loop
+// reads x, y and type instead of a whole ship.
+//
+// Ship indices change whenever a ship is removed, so anything that needs to
+// refer to a ship for longer keeps a ShipHandle instead. A handle names a
+// slot and the generation of that slot, removing a ship bumps the generation
+// so old handles simply stop resolving.
+
+struct ShipHandle
+{
+	int slot; // -1 for no ship
+	int generation;
+};
+
+const ShipHandle noShip = {-1, 0};
+
+struct ShipStore
+{
+	float *x;
+	float *y;
+	float *vx;
+	float *vy;
+	// last applied force, only kept for debug rendering
+	float *fx;
+	float *fy;
+	float *health;
+	float *weaponTimer;
+	// type 0 = fighter
+	//      1 = bomber
+	//      2 = cruiser
+	int *type;
+	// team 0 = player
+	//      1 = enemy
+	int *team;
+	ShipHandle *target; // noShip if cruising
+	float *damage; // damage dealt to the target this tick, applied after all ships fired
+	// per ship temporaries for the batch kernels, not preserved by moves
+	float *scratch;
+	int *slot; // handle slot of each ship
+
+	int num;
+	int len;
+
+	// indexed by handle slot, there are never more slots than len
+	int *slotIndex; // index of the ship in the columns, -1 if free
+	int *slotGeneration;
+	int *freeSlots;
+	int numFreeSlots;
+	int numSlots;
+};
+
+// make room for at least len ships, returns false if the columns couldn't grow
+bool shipStoreReserve(ShipStore* store, int len)
+{
+	if (len <= store->len)
+		return true;
+
+	bool success = true;
+	success &= growColumn((void**) &store->x, len, sizeof(float));
+	success &= growColumn((void**) &store->y, len, sizeof(float));
+	success &= growColumn((void**) &store->vx, len, sizeof(float));
+	success &= growColumn((void**) &store->vy, len, sizeof(float));
+	success &= growColumn((void**) &store->fx, len, sizeof(float));
+	success &= growColumn((void**) &store->fy, len, sizeof(float));
+	success &= growColumn((void**) &store->health, len, sizeof(float));
+	success &= growColumn((void**) &store->weaponTimer, len, sizeof(float));
+	success &= growColumn((void**) &store->type, len, sizeof(int));
+	success &= growColumn((void**) &store->team, len, sizeof(int));
+	success &= growColumn((void**) &store->target, len, sizeof(ShipHandle));
+	success &= growColumn((void**) &store->damage, len, sizeof(float));
+	success &= growColumn((void**) &store->scratch, len, sizeof(float));
+	success &= growColumn((void**) &store->slot, len, sizeof(int));
+	success &= growColumn((void**) &store->slotIndex, len, sizeof(int));
+	success &= growColumn((void**) &store->slotGeneration, len, sizeof(int));
+	success &= growColumn((void**) &store->freeSlots, len, sizeof(int));
+	// columns that did grow are fine to keep, len only covers what all of them hold
+	if (success)
+		store->len = len;
+	return success;
+}
+
+// appends a zeroed ship and returns its index
+int shipStoreAdd(ShipStore* store)
+{
+	if (store->num == store->len)
+		return -1;
+	int i = store->num;
+	store->num++;
+
+	// reuse a free slot if there is one
+	int slot;
+	if (store->numFreeSlots > 0)
+	{
+		store->numFreeSlots--;
+		slot = store->freeSlots[store->numFreeSlots];
+	} else {
+		slot = store->numSlots;
+		store->numSlots++;
+		store->slotGeneration[slot] = 0;
+	}
+	store->slot[i] = slot;
+	store->slotIndex[slot] = i;
+
+	store->x[i] = 0.f;
+	store->y[i] = 0.f;
+	store->vx[i] = 0.f;
+	store->vy[i] = 0.f;
+	store->fx[i] = 0.f;
+	store->fy[i] = 0.f;
+	store->health[i] = 0.f;
+	store->weaponTimer[i] = 0.f;
+	store->type[i] = 0;
+	store->team[i] = 0;
+	store->target[i] = noShip;
+	store->damage[i] = 0.f;
+	return i;
+}
+
+// appends count zeroed ships in one block and returns the index of the
+// first, or -1 if they don't all fit. Same slots as count shipStoreAdd calls.
+int shipStoreAddBlock(ShipStore* store, int count)
+{
+	if (count > store->len - store->num)
+		return -1;
+	int first = store->num;
+	store->num += count;
+
+	for (int i = first; i < first + count; i++)
+	{
+		int slot;
+		if (store->numFreeSlots > 0)
+		{
+			store->numFreeSlots--;
+			slot = store->freeSlots[store->numFreeSlots];
+		} else {
+			slot = store->numSlots;
+			store->numSlots++;
+			store->slotGeneration[slot] = 0;
+		}
+		store->slot[i] = slot;
+		store->slotIndex[slot] = i;
+		store->target[i] = noShip;
+	}
+
+	// all zero bits are 0.f
+	memset(store->x + first, 0, count * sizeof(float));
+	memset(store->y + first, 0, count * sizeof(float));
+	memset(store->vx + first, 0, count * sizeof(float));
+	memset(store->vy + first, 0, count * sizeof(float));
+	memset(store->fx + first, 0, count * sizeof(float));
+	memset(store->fy + first, 0, count * sizeof(float));
+	memset(store->health + first, 0, count * sizeof(float));
+	memset(store->weaponTimer + first, 0, count * sizeof(float));
+	memset(store->type + first, 0, count * sizeof(int));
+	memset(store->team + first, 0, count * sizeof(int));
+	memset(store->damage + first, 0, count * sizeof(float));
+	return first;
+}
+
+// moves ship src to index dst, overwriting whatever was there
+void shipStoreMove(ShipStore* store, int dst, int src)
+{
+	store->slot[dst] = store->slot[src];
+	store->slotIndex[store->slot[dst]] = dst;
+	store->x[dst] = store->x[src];
+	store->y[dst] = store->y[src];
+	store->vx[dst] = store->vx[src];
+	store->vy[dst] = store->vy[src];
+	store->fx[dst] = store->fx[src];
+	store->fy[dst] = store->fy[src];
+	store->health[dst] = store->health[src];
+	store->weaponTimer[dst] = store->weaponTimer[src];
+	store->type[dst] = store->type[src];
+	store->team[dst] = store->team[src];
+	store->target[dst] = store->target[src];
+	store->damage[dst] = store->damage[src];
+}
+
+// removes ship i by moving the last ship into its place, handles to ship i become invalid
+void shipStoreRemove(ShipStore* store, int i)
+{
+	int slot = store->slot[i];
+	store->slotIndex[slot] = -1;
+	store->slotGeneration[slot]++;
+	store->freeSlots[store->numFreeSlots] = slot;
+	store->numFreeSlots++;
+
+	store->num--;
+	if (i != store->num)
+		shipStoreMove(store, i, store->num);
+}
+
+// drops all ships, handles to them become invalid
+void shipStoreClear(ShipStore* store)
+{
+	while (store->num > 0)
+		shipStoreRemove(store, store->num - 1);
+}
+
+inline ShipHandle shipStoreHandle(ShipStore* store, int i)
+{
+	ShipHandle h;
+	h.slot = store->slot[i];
+	h.generation = store->slotGeneration[h.slot];
+	return h;
+}
+
+// returns the current index of the ship or -1 if it doesn't exist anymore
+inline int shipStoreResolve(ShipStore* store, ShipHandle h)
+{
+	if (h.slot < 0 || h.slot >= store->numSlots || store->slotGeneration[h.slot] != h.generation)
+		return -1;
+	return store->slotIndex[h.slot];
+}
+
+void shipStoreFree(ShipStore* store)
+{
+	free(store->x);
+	free(store->y);
+	free(store->vx);
+	free(store->vy);
+	free(store->fx);
+	free(store->fy);
+	free(store->health);
+	free(store->weaponTimer);
+	free(store->type);
+	free(store->team);
+	free(store->target);
+	free(store->damage);
+	free(store->scratch);
+	free(store->slot);
+	free(store->slotIndex);
+	free(store->slotGeneration);
+	free(store->freeSlots);
+	memset(store, 0, sizeof(ShipStore));
+}
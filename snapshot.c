@@ -0,0 +1,157 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Snapshots of everything the world renderer needs, published by the
+// simulation thread after every tick and read by the render thread. They go
+// through a triple buffer: the writer fills the back snapshot and swaps it
+// with the middle one, the reader swaps the middle one with its front
+// snapshot whenever a new one was published. Neither side ever waits and a
+// snapshot doesn't change while it is read.
+//
+// Every ship also carries its position in the previous published snapshot,
+// so the renderer can interpolate between the last two ticks from just the
+// latest snapshot.
+
+#define SNAPSHOT_FRESH 4 // set in middle while the reader hasn't taken it
+
+struct ShipSnapshot
+{
+	float x;
+	float y;
+	float prevx;
+	float prevy;
+	// velocity and force, for the debug lines
+	float vx;
+	float vy;
+	float fx;
+	float fy;
+	float health; // fraction of base health
+	int type;
+	int team;
+	int target; // index of the ship it is firing at, -1 if none
+};
+
+struct PlanetSnapshot
+{
+	float x;
+	float y;
+	float radius;
+	float color[3];
+};
+
+struct Snapshot
+{
+	double time; // monotonicTime when published
+	double interval; // time since the previous snapshot
+
+	ShipSnapshot *ships;
+	int numShips;
+	int lenShips;
+
+	PlanetSnapshot *planets;
+	int numPlanets;
+	int lenPlanets;
+};
+
+struct SnapshotBuffer
+{
+	Snapshot snapshots[3];
+	int back; // only used by the writer
+	int middle; // index | SNAPSHOT_FRESH, accessed atomically
+	int front; // only used by the reader
+
+	// writer side, position of every ship handle slot in the last snapshot
+	float *lastX;
+	float *lastY;
+	int *lastGeneration; // generation of the slot when written, -1 if never
+	int lenLast;
+	double lastTime;
+};
+
+void initSnapshots(SnapshotBuffer* buffer)
+{
+	memset(buffer, 0, sizeof(SnapshotBuffer));
+	buffer->back = 0;
+	buffer->middle = 1;
+	buffer->front = 2;
+}
+
+// makes room for the given number of ships and planets in the back snapshot,
+// and for tracking handle slots below numSlots
+bool snapshotReserve(SnapshotBuffer* buffer, int numShips, int numSlots, int numPlanets)
+{
+	Snapshot* s = &buffer->snapshots[buffer->back];
+	if (numShips > s->lenShips)
+	{
+		int len = grownLength(s->lenShips, numShips);
+		if (!growColumn((void**) &s->ships, len, sizeof(ShipSnapshot)))
+			return false;
+		s->lenShips = len;
+	}
+	if (numPlanets > s->lenPlanets)
+	{
+		if (!growColumn((void**) &s->planets, numPlanets, sizeof(PlanetSnapshot)))
+			return false;
+		s->lenPlanets = numPlanets;
+	}
+	if (numSlots > buffer->lenLast)
+	{
+		int len = grownLength(buffer->lenLast, numSlots);
+		bool success = true;
+		success &= growColumn((void**) &buffer->lastX, len, sizeof(float));
+		success &= growColumn((void**) &buffer->lastY, len, sizeof(float));
+		success &= growColumn((void**) &buffer->lastGeneration, len, sizeof(int));
+		if (!success)
+			return false;
+		for (int i = buffer->lenLast; i < len; i++)
+			buffer->lastGeneration[i] = -1;
+		buffer->lenLast = len;
+	}
+	return true;
+}
+
+// the snapshot the writer is filling
+inline Snapshot* snapshotBack(SnapshotBuffer* buffer)
+{
+	return &buffer->snapshots[buffer->back];
+}
+
+// sets prevx and prevy of ship i in the back snapshot from where the ship
+// with that handle was last published, and remembers the current position
+void snapshotTrack(SnapshotBuffer* buffer, int i, int slot, int generation)
+{
+	ShipSnapshot* ship = &buffer->snapshots[buffer->back].ships[i];
+	if (buffer->lastGeneration[slot] == generation)
+	{
+		ship->prevx = buffer->lastX[slot];
+		ship->prevy = buffer->lastY[slot];
+	} else {
+		ship->prevx = ship->x;
+		ship->prevy = ship->y;
+	}
+	buffer->lastX[slot] = ship->x;
+	buffer->lastY[slot] = ship->y;
+	buffer->lastGeneration[slot] = generation;
+}
+
+void publishSnapshot(SnapshotBuffer* buffer, double time)
+{
+	Snapshot* s = &buffer->snapshots[buffer->back];
+	s->time = time;
+	s->interval = buffer->lastTime > 0.0 ? time - buffer->lastTime : 0.0;
+	buffer->lastTime = time;
+	int old = __atomic_exchange_n(&buffer->middle, buffer->back | SNAPSHOT_FRESH, __ATOMIC_ACQ_REL);
+	buffer->back = old & ~SNAPSHOT_FRESH;
+}
+
+// the latest published snapshot, stays valid until the next call
+Snapshot* acquireSnapshot(SnapshotBuffer* buffer)
+{
+	if (__atomic_load_n(&buffer->middle, __ATOMIC_RELAXED) & SNAPSHOT_FRESH)
+	{
+		int old = __atomic_exchange_n(&buffer->middle, buffer->front, __ATOMIC_ACQ_REL);
+		buffer->front = old & ~SNAPSHOT_FRESH;
+	}
+	return &buffer->snapshots[buffer->front];
+}
\ No newline at end of file
@@ -0,0 +1,198 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+// Uniform grid over the (unbounded) game plane. Cells are hashed into a
+// power of two sized bucket table, so the grid doesn't need to know the
+// world bounds up front. Entries are bucket sorted once per build, queries
+// then only look at the cells overlapping the query circle.
+
+struct GridEntry
+{
+	int index; // index of the entity in whatever array was inserted
+	int team;
+	int cx;
+	int cy;
+	float x;
+	float y;
+};
+
+struct SpatialGrid
+{
+	float cellSize;
+
+	// entries sorted by bucket, bucket b spans bucketStart[b] .. bucketStart[b + 1]
+	GridEntry *entries;
+	GridEntry *unsorted;
+	int numEntries;
+	int lenEntries;
+
+	int *bucketStart;
+	int numBuckets;
+	int lenBuckets;
+};
+
+// cursor for walking the entries within a circle, see gridQueryBegin
+struct GridQuery
+{
+	SpatialGrid* grid;
+	Vectorf p;
+	float rsqr;
+	int team;
+
+	int cx0, cx1, cy1;
+	int cx, cy;
+	int i, end; // remaining range of the current bucket
+};
+
+inline int gridCell(float v, float cellSize)
+{
+	return (int) floorf(v / cellSize);
+}
+
+// teams are hashed into separate buckets so team queries skip the other teams
+inline int gridBucket(SpatialGrid* g, int cx, int cy, int team)
+{
+	return (int) (((unsigned) cx * 73856093u ^ (unsigned) cy * 19349663u ^ (unsigned) team * 83492791u) & (unsigned) (g->numBuckets - 1));
+}
+
+// start a new build, capacity is the expected number of entries
+void gridBegin(SpatialGrid* g, float cellSize, int capacity)
+{
+	g->cellSize = cellSize;
+	g->numEntries = 0;
+
+	// aim for roughly one entry per bucket
+	int buckets = 64;
+	while (buckets < capacity)
+		buckets *= 2;
+	if (buckets + 1 > g->lenBuckets)
+	{
+		if (!growColumn((void**) &g->bucketStart, buckets + 1, sizeof(int)))
+		{
+			LOG_ERROR("Couldn't increase grid bucket count, keeping %d buckets.\n", g->numBuckets);
+			return;
+		}
+		g->lenBuckets = buckets + 1;
+	}
+	g->numBuckets = buckets;
+}
+
+void gridInsert(SpatialGrid* g, int index, Vectorf position, int team)
+{
+	if (g->numEntries == g->lenEntries)
+	{
+		int len = g->lenEntries > 0 ? g->lenEntries * 2 : 256;
+		bool success = true;
+		success &= growColumn((void**) &g->unsorted, len, sizeof(GridEntry));
+		success &= growColumn((void**) &g->entries, len, sizeof(GridEntry));
+		if (!success)
+		{
+			LOG_ERROR("Couldn't increase grid size, dropping entry.\n");
+			return;
+		}
+		g->lenEntries = len;
+	}
+
+	GridEntry* e = &g->unsorted[g->numEntries];
+	g->numEntries++;
+
+	e->index = index;
+	e->team = team;
+	e->x = position.x;
+	e->y = position.y;
+	e->cx = gridCell(position.x, g->cellSize);
+	e->cy = gridCell(position.y, g->cellSize);
+}
+
+// sort the inserted entries into their buckets, must be called before querying
+void gridFinish(SpatialGrid* g)
+{
+	int* start = g->bucketStart;
+	if (!start)
+		return;
+	memset(start, 0, (g->numBuckets + 1) * sizeof(int));
+
+	// counting sort, keeps insertion order inside a bucket
+	for (int i = 0; i < g->numEntries; i++)
+		start[gridBucket(g, g->unsorted[i].cx, g->unsorted[i].cy, g->unsorted[i].team) + 1]++;
+	for (int b = 0; b < g->numBuckets; b++)
+		start[b + 1] += start[b];
+	for (int i = 0; i < g->numEntries; i++)
+	{
+		int b = gridBucket(g, g->unsorted[i].cx, g->unsorted[i].cy, g->unsorted[i].team);
+		g->entries[start[b]] = g->unsorted[i];
+		start[b]++;
+	}
+	// the placement loop shifted every start to the next bucket, shift back
+	for (int b = g->numBuckets; b > 0; b--)
+		start[b] = start[b - 1];
+	start[0] = 0;
+}
+
+// start walking all entries of the given team within r of p (as of the last build)
+void gridQueryBegin(GridQuery* q, SpatialGrid* g, Vectorf p, float r, int team)
+{
+	q->grid = g;
+	q->p = p;
+	q->rsqr = r * r;
+	q->team = team;
+	q->cx0 = gridCell(p.x - r, g->cellSize);
+	q->cx1 = gridCell(p.x + r, g->cellSize);
+	q->cy1 = gridCell(p.y + r, g->cellSize);
+	q->cx = q->cx0 - 1; // the first gridQueryNext moves on to cx0
+	q->cy = gridCell(p.y - r, g->cellSize);
+	q->i = 0;
+	q->end = 0;
+	if (g->numBuckets == 0)
+		q->cy = q->cy1 + 1;
+}
+
+// returns the index of the next entry in range or -1 once all cells are exhausted
+int gridQueryNext(GridQuery* q)
+{
+	SpatialGrid* g = q->grid;
+	while (true)
+	{
+		while (q->i < q->end)
+		{
+			GridEntry* e = &g->entries[q->i];
+			q->i++;
+			// different cells can share a bucket
+			if (e->cx != q->cx || e->cy != q->cy || e->team != q->team)
+				continue;
+			float dx = e->x - q->p.x;
+			float dy = e->y - q->p.y;
+			if (dx * dx + dy * dy <= q->rsqr)
+				return e->index;
+		}
+
+		// advance to the next cell
+		q->cx++;
+		if (q->cx > q->cx1)
+		{
+			q->cx = q->cx0;
+			q->cy++;
+		}
+		if (q->cy > q->cy1)
+			return -1;
+		int b = gridBucket(g, q->cx, q->cy, q->team);
+		q->i = g->bucketStart[b];
+		q->end = g->bucketStart[b + 1];
+	}
+}
+
+void gridFree(SpatialGrid* g)
+{
+	free(g->entries);
+	free(g->unsorted);
+	free(g->bucketStart);
+	g->entries = NULL;
+	g->unsorted = NULL;
+	g->bucketStart = NULL;
+	g->numEntries = 0;
+	g->lenEntries = 0;
+	g->numBuckets = 0;
+	g->lenBuckets = 0;
+}
@@ -0,0 +1,183 @@
+// Tests without SDL or OpenGL, run them with make test.
+// Files are only written to a temporary directory, which is removed again.
+// Every failure is printed and the exit code is 1 if there was one.
+
+#define HEADLESS
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "game.c"
+
+char testDirectory[] = "/tmp/ooftestXXXXXX";
+
+// name of a file in the temporary directory
+const char* testFile(char* path, size_t size, const char* name)
+{
+	snprintf(path, size, "%s/%s", testDirectory, name);
+	return path;
+}
+
+// every vectorized flavour the CPU supports against the scalar reference, on
+// all lengths from empty to two full vectors, or blocks of the sums, and a tail
+bool testBatchKernels()
+{
+	const BatchKernels* flavours[2];
+	int numFlavours = 0;
+#ifdef BATCH_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("sse2"))
+		flavours[numFlavours++] = &batchSSE2;
+	if (__builtin_cpu_supports("avx2"))
+		flavours[numFlavours++] = &batchAVX2;
+#endif
+	if (numFlavours == 0)
+		printf("No vectorized batch kernels to test on this CPU.\n");
+
+	bool success = true;
+	for (int k = 0; k < numFlavours; k++)
+	{
+		bool matches = true;
+		for (int n = 0; n <= 2 * max(flavours[k]->width, BATCH_LANES) + 1; n++)
+			matches &= checkBatchKernels(flavours[k], n);
+		printf("%s batch kernels: %s\n", flavours[k]->name, matches ? "ok" : "FAILED");
+		success &= matches;
+	}
+	return success;
+}
+
+inline InputEvent testClick(float x, float y, Vectorf world)
+{
+	InputEvent e = inputEvent(input_mouse);
+	e.key = 1;
+	e.ui = vecf(x, y);
+	e.world = world;
+	return e;
+}
+
+// records a session with clicks on the ui and a planet, replays it the way
+// oofbench --replay does and expects it to end in the recorded state
+bool testReplay()
+{
+	char start[256];
+	char inputs[256];
+	recordingStart = testFile(start, sizeof(start), "recording.oof");
+	recordingInputs = testFile(inputs, sizeof(inputs), "recording.inputs");
+
+	initGameValues();
+	loadAssets();
+	createUI();
+	initInputQueue(&game.inputs);
+	newGame(7, 250, 15);
+	game.resources[rsc_sbm] = 1000.f;
+
+	// as in a square window, headless builds don't lay out the ui otherwise
+	UIElement* squareCenter = uiElement("squareCenter");
+	squareCenter->size = vecf(1.f, 1.f);
+
+	InputEvent f7 = inputEvent(input_key);
+	f7.key = SDL_SCANCODE_F7;
+	pushInput(&game.inputs, f7);
+	for (int frame = 0; frame < 120; frame++)
+	{
+		if (frame == 5)
+			pushInput(&game.inputs, testClick(0.5f, 0.5f, game.planets[0].position)); // opens the popup
+		if (frame == 6)
+			pushInput(&game.inputs, testClick(0.32f, 0.82f, vecf(0.f, 0.f))); // the second building
+		if (frame == 7)
+			pushInput(&game.inputs, testClick(0.18f, 0.18f, vecf(0.f, 0.f))); // the first tile
+		simulateFrame(1.0 / SIM_TICK_RATE);
+	}
+	pushInput(&game.inputs, f7);
+	applyInputs();
+	bool built = game.planets[0].tiles[0].buildingType == 3;
+
+	// nothing of the ui carries over to the replay
+	createUI();
+	InputReplay replay;
+	bool success = loadReplay(&replay, recordingInputs) && loadGame(replay.startFile);
+	for (int frame = 0; frame < replay.numFrames && success; frame++)
+	{
+		replayFrame(&replay, &game.inputs, frame);
+		simulateFrame(1.0 / replay.frameRate);
+	}
+	replayFrame(&replay, &game.inputs, replay.numFrames);
+	applyInputs();
+	bool matches = success && gameChecksum() == replay.checksum;
+	freeReplay(&replay);
+	remove(recordingInputs);
+	remove(recordingStart);
+
+	if (!built)
+		printf("The recorded clicks didn't build anything!\n");
+	if (!matches)
+		printf("The replay ended with a different state than the recording!\n");
+	printf("replay: %s\n", built && matches ? "ok" : "FAILED");
+	return built && matches;
+}
+
+// recordings with frames out of order or that aren't numbers don't load
+bool testDamagedReplays()
+{
+	const char* recordings[] = {
+		"oofinputs 2 60 start.oof\n3 key 22\n1 key 22\nend 4 0\n",
+		"oofinputs 2 60 start.oof\nx key 22\nend 4 0\n",
+		"oofinputs 2 60 start.oof\n2x key 22\nend 4 0\n",
+		"oofinputs 2 60 start.oof\n5 key 22\nend 4 0\n",
+	};
+	char path[256];
+	testFile(path, sizeof(path), "damaged.inputs");
+	bool success = true;
+	for (size_t i = 0; i < sizeof(recordings) / sizeof(recordings[0]); i++)
+	{
+		FILE* file = fopen(path, "w");
+		if (!file)
+		{
+			printf("Couldn't write %s!\n", path);
+			return false;
+		}
+		fputs(recordings[i], file);
+		fclose(file);
+		InputReplay replay;
+		if (loadReplay(&replay, path))
+		{
+			printf("Loaded damaged recording %d!\n", (int) i);
+			freeReplay(&replay);
+			success = false;
+		}
+	}
+	remove(path);
+	printf("damaged replays: %s\n", success ? "ok" : "FAILED");
+	return success;
+}
+
+int main()
+{
+	initLog();
+	initJobs(2);
+	if (!mkdtemp(testDirectory))
+	{
+		printf("Couldn't create a temporary directory!\n");
+		return 1;
+	}
+
+	int failed = 0;
+	if (!testBatchKernels())
+		failed++;
+	if (!testReplay())
+		failed++;
+	if (!testDamagedReplays())
+		failed++;
+
+	rmdir(testDirectory);
+	shutdownJobs();
+	shutdownLog();
+
+	if (failed > 0)
+	{
+		printf("%d tests FAILED\n", failed);
+		return 1;
+	}
+	printf("All tests passed\n");
+	return 0;
+}
\ No newline at end of file
@@ -1,7 +1,13 @@
 #include <stdlib.h>
+#include <string.h>
 
-#include <SDL2/SDL.h>
-#include <SDL2/SDL_image.h>
+#ifndef HEADLESS
+	#include <SDL2/SDL.h>
+	#include <SDL2/SDL_image.h>
+#else
+	// no GL in headless builds, textures only keep their names
+	typedef unsigned int GLuint;
+#endif
 
 #if defined(WIN32) || defined(_WIN32)
 	#define PATH_SEPARATOR "\\"
@@ -9,37 +15,319 @@
 	#define PATH_SEPARATOR "/"
 #endif
 
+// All sprites are packed into one atlas texture, a Texture is a region of
+// it. Sprites are placed left to right in rows, each with a border of
+// ATLAS_PADDING copies of its edge pixels so filtering never picks up a
+// neighbour. The atlas also holds a white region, drawing with it gives
+// plain colors without switching the texture.
+//
+// The packed atlas can be baked into an asset pack (oofpack, see
+// packassets.c), which the game maps instead of decoding the PNGs. Either
+// way the pixels go to the gpu through a pixel buffer, a few rows per frame
+// (see uploadAtlas), so loading doesn't wait for the upload.
+
+#define ATLAS_WIDTH 256
+#define ATLAS_MAX_HEIGHT 4096
+#define ATLAS_PADDING 1
+#define ATLAS_UPLOAD_ROWS 64 // per frame
+
+#define ASSET_PACK_MAGIC 0x4b50464f // "OFPK" when read as little endian bytes
+#define ASSET_PACK_VERSION 1
+
 struct Texture
 {
-	GLuint handle;
+	GLuint handle; // of the atlas, 0 until it was uploaded
 	char name[100];
+	// region in texture coordinates
+	float u0;
+	float v0;
+	float u1;
+	float v1;
+};
+
+struct TextureAtlas
+{
+	GLuint handle;
+	int width;
+	int height;
+	unsigned char *pixels; // RGBA, only until uploaded, unless mapped from a pack
+	SaveReader pack;
+
+	// rows still to upload, see uploadAtlas
+	const unsigned char *uploadPixels;
+	int uploadedRows;
+	GLuint uploadBuffer;
+
+	// current row of sprites
+	int x;
+	int y;
+	int rowHeight;
+
+	Texture white;
 };
 
-Texture loadTexture(const char *filename, const char *name)
+// copies a w by h RGBA image to (x, y), padded with its edge pixels
+void atlasBlit(TextureAtlas* atlas, int x, int y, const unsigned char* pixels, int w, int h, int pitch)
+{
+	for (int ty = -ATLAS_PADDING; ty < h + ATLAS_PADDING; ty++)
+	{
+		int sy = ty < 0 ? 0 : (ty >= h ? h - 1 : ty);
+		unsigned char* dst = atlas->pixels + ((y + ty) * atlas->width + x) * 4;
+		const unsigned char* src = pixels + sy * pitch;
+		for (int tx = -ATLAS_PADDING; tx < w + ATLAS_PADDING; tx++)
+		{
+			int sx = tx < 0 ? 0 : (tx >= w ? w - 1 : tx);
+			memcpy(dst + tx * 4, src + sx * 4, 4);
+		}
+	}
+}
+
+// finds room for a w by h sprite and sets tex to its region, pixels may be
+// NULL to only reserve it
+bool atlasAdd(TextureAtlas* atlas, Texture* tex, const unsigned char* pixels, int w, int h, int pitch)
+{
+	int pw = w + 2 * ATLAS_PADDING;
+	int ph = h + 2 * ATLAS_PADDING;
+	if (pw > atlas->width)
+	{
+		LOG_ERROR("Couldn't add %s to the texture atlas, it is wider than %d pixels.\n", tex->name, atlas->width);
+		return false;
+	}
+	if (atlas->x + pw > atlas->width)
+	{
+		atlas->x = 0;
+		atlas->y += atlas->rowHeight;
+		atlas->rowHeight = 0;
+	}
+	if (atlas->y + ph > atlas->height)
+	{
+		int height = atlas->height > 0 ? atlas->height : 64;
+		while (height < atlas->y + ph)
+			height *= 2;
+		if (height > ATLAS_MAX_HEIGHT || !growColumn((void**) &atlas->pixels, atlas->width * height, 4))
+		{
+			LOG_ERROR("Couldn't add %s to the texture atlas, it is full.\n", tex->name);
+			return false;
+		}
+		memset(atlas->pixels + atlas->width * atlas->height * 4, 0, atlas->width * (height - atlas->height) * 4);
+		atlas->height = height;
+	}
+
+	int x = atlas->x + ATLAS_PADDING;
+	int y = atlas->y + ATLAS_PADDING;
+	if (pixels)
+		atlasBlit(atlas, x, y, pixels, w, h, pitch);
+	// the height isn't final yet, so remember pixels and convert in atlasUpload
+	tex->u0 = x;
+	tex->v0 = y;
+	tex->u1 = x + w;
+	tex->v1 = y + h;
+
+	atlas->x += pw;
+	if (ph > atlas->rowHeight)
+		atlas->rowHeight = ph;
+	return true;
+}
+
+void initAtlas(TextureAtlas* atlas)
+{
+	memset(atlas, 0, sizeof(TextureAtlas));
+	atlas->width = ATLAS_WIDTH;
+	strcpy(atlas->white.name, "white");
+	// sample the middle of a 2x2 block, away from the padding
+	const unsigned char white[16] = {255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255};
+	if (atlasAdd(atlas, &atlas->white, white, 2, 2, 8))
+	{
+		atlas->white.u0 = atlas->white.u1 = atlas->white.u0 + 1.f;
+		atlas->white.v0 = atlas->white.v1 = atlas->white.v0 + 1.f;
+	}
+}
+
+Texture loadTexture(TextureAtlas* atlas, const char *filename, const char *name)
 {
 	Texture tex;
-	SDL_Surface* surface = IMG_Load(filename);
+	memset(&tex, 0, sizeof(Texture));
 	strcpy(tex.name, name);
-	tex.handle = 0;
+#ifdef HEADLESS
+	(void) atlas;
+	(void) filename;
+#else
+	SDL_Surface* surface = IMG_Load(filename);
 	if (!surface)
+	{
+		LOG_ERROR("Couldn't load %s.\n", filename);
 		return tex;
+	}
+	// the atlas is RGBA bytes, the files may be paletted or have no alpha
+	SDL_Surface* rgba = SDL_ConvertSurfaceFormat(surface, SDL_PIXELFORMAT_RGBA32, 0);
+	SDL_FreeSurface(surface);
+	if (!rgba)
+	{
+		LOG_ERROR("Couldn't convert %s to RGBA.\n", filename);
+		return tex;
+	}
+	atlasAdd(atlas, &tex, (const unsigned char*) rgba->pixels, rgba->w, rgba->h, rgba->pitch);
+	SDL_FreeSurface(rgba);
+#endif
+
+	return tex;
+}
+
+// writes the atlas with the pixel regions of the textures, before finishAtlas
+bool writeAssetPack(TextureAtlas* atlas, Texture* textures, int numTextures, const char* filename)
+{
+	SaveWriter w;
+	if (!openSaveWriter(&w, filename))
+		return false;
+	saveWriteHeader(&w);
+	saveWriteInt(&w, atlas->width);
+	saveWriteInt(&w, atlas->height);
+	saveWriteInt(&w, numTextures);
+	for (int i = -1; i < numTextures; i++)
+	{
+		Texture* tex = i < 0 ? &atlas->white : &textures[i];
+		saveWrite(&w, tex->name, sizeof(tex->name));
+		saveWriteFloat(&w, tex->u0);
+		saveWriteFloat(&w, tex->v0);
+		saveWriteFloat(&w, tex->u1);
+		saveWriteFloat(&w, tex->v1);
+	}
+	saveWrite(&w, atlas->pixels, atlas->width * atlas->height * 4);
+	return closeSaveWriter(&w, ASSET_PACK_VERSION, ASSET_PACK_MAGIC);
+}
 
-	glGenTextures(1, &tex.handle);
-	glBindTexture(GL_TEXTURE_2D, tex.handle);
-	//                          mipmap level                        border
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, surface->w, surface->h, 0, GL_RGBA, GL_UNSIGNED_BYTE, surface->pixels);
+// maps an asset pack into the atlas, textures must be named already and the
+// pack has to contain exactly these. Its pixels stay mapped until uploaded.
+bool loadAssetPack(TextureAtlas* atlas, Texture* textures, int numTextures, const char* filename)
+{
+	memset(atlas, 0, sizeof(TextureAtlas));
+	SaveReader* r = &atlas->pack;
+	if (!openSaveReader(r, filename))
+		return false;
+	uint32_t version = saveReadHeader(r, ASSET_PACK_MAGIC);
+	if (!r->failed && version != ASSET_PACK_VERSION)
+	{
+		LOG_ERROR("Couldn't load %s, it is version %u instead of %d.\n", filename, version, ASSET_PACK_VERSION);
+		r->failed = true;
+	}
+	atlas->width = saveReadCount(r, ATLAS_WIDTH);
+	atlas->height = saveReadCount(r, ATLAS_MAX_HEIGHT);
+	if (saveReadCount(r, numTextures) != numTextures)
+		r->failed = true;
+	for (int i = -1; i < numTextures && !r->failed; i++)
+	{
+		Texture* tex = i < 0 ? &atlas->white : &textures[i];
+		char name[sizeof(tex->name)];
+		saveRead(r, name, sizeof(name));
+		name[sizeof(name) - 1] = '\0';
+		if (i >= 0 && strcmp(name, tex->name) != 0)
+		{
+			LOG_ERROR("Couldn't load %s, it has %s where %s should be.\n", filename, name, tex->name);
+			r->failed = true;
+		}
+		strcpy(tex->name, name);
+		tex->handle = 0;
+		tex->u0 = saveReadFloat(r);
+		tex->v0 = saveReadFloat(r);
+		tex->u1 = saveReadFloat(r);
+		tex->v1 = saveReadFloat(r);
+	}
+	const unsigned char* pixels = saveReadBlock(r, (size_t) atlas->width * atlas->height * 4);
+	if (r->failed || atlas->width != ATLAS_WIDTH || atlas->height == 0)
+	{
+		LOG_ERROR("Couldn't load %s, it is damaged or out of date.\n", filename);
+		closeSaveReader(r);
+		return false;
+	}
+	atlas->uploadPixels = pixels;
+	return true;
+}
+
+// frees the pixels, or unmaps them if they came from a pack
+void releaseAtlasPixels(TextureAtlas* atlas)
+{
+	free(atlas->pixels);
+	atlas->pixels = NULL;
+	closeSaveReader(&atlas->pack);
+	atlas->uploadPixels = NULL;
+}
+
+// turns the pixel regions of the textures into texture coordinates, and on
+// the gpu side creates the atlas, its pixels are uploaded by uploadAtlas
+void finishAtlas(TextureAtlas* atlas, Texture* textures, int numTextures)
+{
+	float w = atlas->width;
+	float h = atlas->height > 0 ? atlas->height : 1;
+	for (int i = -1; i < numTextures; i++)
+	{
+		Texture* tex = i < 0 ? &atlas->white : &textures[i];
+		tex->u0 /= w;
+		tex->v0 /= h;
+		tex->u1 /= w;
+		tex->v1 /= h;
+	}
+	if (!atlas->uploadPixels)
+		atlas->uploadPixels = atlas->pixels;
+	atlas->uploadedRows = 0;
+
+#ifndef HEADLESS
+	glGenTextures(1, &atlas->handle);
+	glBindTexture(GL_TEXTURE_2D, atlas->handle);
+	//                          mipmap level                                    border
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, atlas->width, atlas->height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
 
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glBindTexture(GL_TEXTURE_2D, 0);
 
-	SDL_FreeSurface(surface);
+	glGenBuffers(1, &atlas->uploadBuffer);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, atlas->uploadBuffer);
+	glBufferData(GL_PIXEL_UNPACK_BUFFER, atlas->width * atlas->height * 4, NULL, GL_STREAM_DRAW);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+#else
+	releaseAtlasPixels(atlas);
+#endif
 
-	return tex;
+	atlas->white.handle = atlas->handle;
+	for (int i = 0; i < numTextures; i++)
+		textures[i].handle = atlas->handle;
 }
 
-void unloadTexture(Texture* tex)
+#ifndef HEADLESS
+// copies up to maxRows more rows into the pixel buffer and lets the driver
+// transfer them to the atlas, returns true once all rows are uploaded
+bool uploadAtlas(TextureAtlas* atlas, int maxRows)
 {
-	glDeleteTextures(1, &tex->handle);
+	if (!atlas->uploadPixels)
+		return true;
+	int rows = atlas->height - atlas->uploadedRows;
+	if (rows > maxRows)
+		rows = maxRows;
+	size_t rowSize = atlas->width * 4;
+	size_t offset = atlas->uploadedRows * rowSize;
+
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, atlas->uploadBuffer);
+	glBufferSubData(GL_PIXEL_UNPACK_BUFFER, offset, rows * rowSize, atlas->uploadPixels + offset);
+	glBindTexture(GL_TEXTURE_2D, atlas->handle);
+	// with a pixel buffer bound the last argument is an offset into it
+	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, atlas->uploadedRows, atlas->width, rows, GL_RGBA, GL_UNSIGNED_BYTE, (const void*) offset);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	atlas->uploadedRows += rows;
+	if (atlas->uploadedRows < atlas->height)
+		return false;
+
+	// gl keeps the buffer until the transfer is done
+	glDeleteBuffers(1, &atlas->uploadBuffer);
+	atlas->uploadBuffer = 0;
+	releaseAtlasPixels(atlas);
+	return true;
+}
+
+void unloadAtlas(TextureAtlas* atlas)
+{
+	glDeleteTextures(1, &atlas->handle);
+	atlas->handle = 0;
 }
 
 void bindTexture(Texture* tex)
@@ -55,4 +343,5 @@ void unbindTexture(Texture* tex)
 	if (!tex)
 		return;
 	glDisable(GL_TEXTURE_2D);
-}
\ No newline at end of file
+}
+#endif
\ No newline at end of file
@@ -1,5 +1,7 @@
 #include <math.h>
 #include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
 
 struct Vectorf
 {
@@ -86,17 +88,390 @@ inline Vectorf normalize(Vectorf v1)
 	}
 }
 
-inline float randomFloat()
+// batch kernels
+//
+// These work on plain float columns (see shipstore.c) instead of Vectorf and
+// come in scalar, SSE2 and AVX2 flavours. initBatchKernels picks the widest
+// one the CPU supports, until then the scalar versions are used.
+// All flavours produce bit identical results, so the choice doesn't leak
+// into the simulation. The inverse distance sums are added up in the same
+// order everywhere for that, see BATCH_LANES.
+
+#if defined(__x86_64__) || defined(__i386__)
+	#define BATCH_X86
+	#include <immintrin.h>
+#endif
+
+#define BATCH_MAX_GROUPS 4
+
+// The inverse distance sums keep BATCH_LANES partial sums per group, point i
+// of every full block goes to lane i % BATCH_LANES. The lanes are added
+// pairwise at the end and the rest of the points one by one after that.
+#define BATCH_LANES 8
+
+// out[i] = |(x[i], y[i]) - (px, py)|
+void batchDistanceScalar(const float* x, const float* y, float px, float py, float* out, int n)
 {
-	return (float)rand()/(float)(RAND_MAX);
+	for (int i = 0; i < n; i++)
+	{
+		float dx = x[i] - px;
+		float dy = y[i] - py;
+		out[i] = sqrtf(dx * dx + dy * dy);
+	}
 }
 
-inline Vectorf randomBetween(Vectorf v1, Vectorf v2)
+// normalizes the vectors (x[i], y[i]) in place, zero vectors stay zero
+void batchNormalizeScalar(float* x, float* y, int n)
 {
-	Vectorf v;
-	v.x = v1.x + (v2.x - v1.x) * randomFloat();
-	v.y = v1.y + (v2.y - v1.y) * randomFloat();
-	v.z = v1.z + (v2.z - v1.z) * randomFloat();
-	v.w = v1.w + (v2.w - v1.w) * randomFloat();
-	return v;
-}
\ No newline at end of file
+	for (int i = 0; i < n; i++)
+	{
+		float f = sqrtf(x[i] * x[i] + y[i] * y[i]);
+		if (f != 0.f)
+		{
+			float inv = 1.f / f;
+			x[i] *= inv;
+			y[i] *= inv;
+		}
+	}
+}
+
+// (x[i], y[i]) += (dx[i], dy[i]) * scale[i]
+void batchScaleAddScalar(float* x, float* y, const float* dx, const float* dy, const float* scale, int n)
+{
+	for (int i = 0; i < n; i++)
+	{
+		x[i] += dx[i] * scale[i];
+		y[i] += dy[i] * scale[i];
+	}
+}
+
+inline float inverseDistance(float x, float y, float px, float py)
+{
+	float dx = x - px;
+	float dy = y - py;
+	float r = sqrtf(dx * dx + dy * dy);
+	if (r <= 0.f)
+		return 0.f;
+	float f = 1.f / r;
+	return f < 1.f ? f : 1.f;
+}
+
+inline float sumLanes(const float* lanes)
+{
+	return ((lanes[0] + lanes[1]) + (lanes[2] + lanes[3])) + ((lanes[4] + lanes[5]) + (lanes[6] + lanes[7]));
+}
+
+// sums[group[i]] += min(1 / r, 1) with r = |(x[i], y[i]) - (px, py)|, points at r = 0 are skipped
+void batchInverseDistanceSumScalar(const float* x, const float* y, const int* group, int n, float px, float py, float* sums, int numGroups)
+{
+	float acc[BATCH_MAX_GROUPS][BATCH_LANES];
+	memset(acc, 0, sizeof(acc));
+	int i = 0;
+	for (; i + BATCH_LANES <= n; i += BATCH_LANES)
+	{
+		for (int l = 0; l < BATCH_LANES; l++)
+			acc[group[i + l]][l] += inverseDistance(x[i + l], y[i + l], px, py);
+	}
+	for (int g = 0; g < numGroups; g++)
+		sums[g] += sumLanes(acc[g]);
+	for (; i < n; i++)
+		sums[group[i]] += inverseDistance(x[i], y[i], px, py);
+}
+
+#ifdef BATCH_X86
+
+__attribute__((target("sse2")))
+void batchDistanceSSE2(const float* x, const float* y, float px, float py, float* out, int n)
+{
+	__m128 vpx = _mm_set1_ps(px);
+	__m128 vpy = _mm_set1_ps(py);
+	int i = 0;
+	for (; i + 4 <= n; i += 4)
+	{
+		__m128 dx = _mm_sub_ps(_mm_loadu_ps(x + i), vpx);
+		__m128 dy = _mm_sub_ps(_mm_loadu_ps(y + i), vpy);
+		_mm_storeu_ps(out + i, _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy))));
+	}
+	batchDistanceScalar(x + i, y + i, px, py, out + i, n - i);
+}
+
+__attribute__((target("sse2")))
+void batchNormalizeSSE2(float* x, float* y, int n)
+{
+	__m128 zero = _mm_setzero_ps();
+	__m128 one = _mm_set1_ps(1.f);
+	int i = 0;
+	for (; i + 4 <= n; i += 4)
+	{
+		__m128 vx = _mm_loadu_ps(x + i);
+		__m128 vy = _mm_loadu_ps(y + i);
+		__m128 f = _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(vx, vx), _mm_mul_ps(vy, vy)));
+		__m128 nonzero = _mm_cmpneq_ps(f, zero);
+		// divide by one where f is zero, that leaves the vector untouched
+		__m128 inv = _mm_div_ps(one, _mm_or_ps(_mm_and_ps(nonzero, f), _mm_andnot_ps(nonzero, one)));
+		_mm_storeu_ps(x + i, _mm_mul_ps(vx, inv));
+		_mm_storeu_ps(y + i, _mm_mul_ps(vy, inv));
+	}
+	batchNormalizeScalar(x + i, y + i, n - i);
+}
+
+__attribute__((target("sse2")))
+void batchScaleAddSSE2(float* x, float* y, const float* dx, const float* dy, const float* scale, int n)
+{
+	int i = 0;
+	for (; i + 4 <= n; i += 4)
+	{
+		__m128 s = _mm_loadu_ps(scale + i);
+		_mm_storeu_ps(x + i, _mm_add_ps(_mm_loadu_ps(x + i), _mm_mul_ps(_mm_loadu_ps(dx + i), s)));
+		_mm_storeu_ps(y + i, _mm_add_ps(_mm_loadu_ps(y + i), _mm_mul_ps(_mm_loadu_ps(dy + i), s)));
+	}
+	batchScaleAddScalar(x + i, y + i, dx + i, dy + i, scale + i, n - i);
+}
+
+__attribute__((target("sse2")))
+inline __m128 inverseDistanceSSE2(const float* x, const float* y, __m128 px, __m128 py)
+{
+	__m128 zero = _mm_setzero_ps();
+	__m128 one = _mm_set1_ps(1.f);
+	__m128 dx = _mm_sub_ps(_mm_loadu_ps(x), px);
+	__m128 dy = _mm_sub_ps(_mm_loadu_ps(y), py);
+	__m128 r = _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)));
+	__m128 valid = _mm_cmpgt_ps(r, zero);
+	// r = 0 would divide by zero, those lanes are masked out anyway
+	__m128 f = _mm_min_ps(_mm_div_ps(one, _mm_or_ps(_mm_and_ps(valid, r), _mm_andnot_ps(valid, one))), one);
+	return _mm_and_ps(f, valid);
+}
+
+// two vectors per block, so the lanes are the same as in the other flavours
+__attribute__((target("sse2")))
+void batchInverseDistanceSumSSE2(const float* x, const float* y, const int* group, int n, float px, float py, float* sums, int numGroups)
+{
+	__m128 vpx = _mm_set1_ps(px);
+	__m128 vpy = _mm_set1_ps(py);
+	__m128 acc[BATCH_MAX_GROUPS][2];
+	for (int g = 0; g < numGroups; g++)
+		acc[g][0] = acc[g][1] = _mm_setzero_ps();
+
+	int i = 0;
+	for (; i + BATCH_LANES <= n; i += BATCH_LANES)
+	{
+		for (int h = 0; h < 2; h++)
+		{
+			__m128 f = inverseDistanceSSE2(x + i + h * 4, y + i + h * 4, vpx, vpy);
+			__m128i vg = _mm_loadu_si128((const __m128i*) (group + i + h * 4));
+			for (int g = 0; g < numGroups; g++)
+				acc[g][h] = _mm_add_ps(acc[g][h], _mm_and_ps(f, _mm_castsi128_ps(_mm_cmpeq_epi32(vg, _mm_set1_epi32(g)))));
+		}
+	}
+	for (int g = 0; g < numGroups; g++)
+	{
+		float lanes[BATCH_LANES];
+		_mm_storeu_ps(lanes, acc[g][0]);
+		_mm_storeu_ps(lanes + 4, acc[g][1]);
+		sums[g] += sumLanes(lanes);
+	}
+	for (; i < n; i++)
+		sums[group[i]] += inverseDistance(x[i], y[i], px, py);
+}
+
+__attribute__((target("avx2")))
+void batchDistanceAVX2(const float* x, const float* y, float px, float py, float* out, int n)
+{
+	__m256 vpx = _mm256_set1_ps(px);
+	__m256 vpy = _mm256_set1_ps(py);
+	int i = 0;
+	for (; i + 8 <= n; i += 8)
+	{
+		__m256 dx = _mm256_sub_ps(_mm256_loadu_ps(x + i), vpx);
+		__m256 dy = _mm256_sub_ps(_mm256_loadu_ps(y + i), vpy);
+		_mm256_storeu_ps(out + i, _mm256_sqrt_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy))));
+	}
+	batchDistanceScalar(x + i, y + i, px, py, out + i, n - i);
+}
+
+__attribute__((target("avx2")))
+void batchNormalizeAVX2(float* x, float* y, int n)
+{
+	__m256 zero = _mm256_setzero_ps();
+	__m256 one = _mm256_set1_ps(1.f);
+	int i = 0;
+	for (; i + 8 <= n; i += 8)
+	{
+		__m256 vx = _mm256_loadu_ps(x + i);
+		__m256 vy = _mm256_loadu_ps(y + i);
+		__m256 f = _mm256_sqrt_ps(_mm256_add_ps(_mm256_mul_ps(vx, vx), _mm256_mul_ps(vy, vy)));
+		__m256 nonzero = _mm256_cmp_ps(f, zero, _CMP_NEQ_UQ);
+		// divide by one where f is zero, that leaves the vector untouched
+		__m256 inv = _mm256_div_ps(one, _mm256_blendv_ps(one, f, nonzero));
+		_mm256_storeu_ps(x + i, _mm256_mul_ps(vx, inv));
+		_mm256_storeu_ps(y + i, _mm256_mul_ps(vy, inv));
+	}
+	batchNormalizeScalar(x + i, y + i, n - i);
+}
+
+__attribute__((target("avx2")))
+void batchScaleAddAVX2(float* x, float* y, const float* dx, const float* dy, const float* scale, int n)
+{
+	int i = 0;
+	for (; i + 8 <= n; i += 8)
+	{
+		__m256 s = _mm256_loadu_ps(scale + i);
+		_mm256_storeu_ps(x + i, _mm256_add_ps(_mm256_loadu_ps(x + i), _mm256_mul_ps(_mm256_loadu_ps(dx + i), s)));
+		_mm256_storeu_ps(y + i, _mm256_add_ps(_mm256_loadu_ps(y + i), _mm256_mul_ps(_mm256_loadu_ps(dy + i), s)));
+	}
+	batchScaleAddScalar(x + i, y + i, dx + i, dy + i, scale + i, n - i);
+}
+
+__attribute__((target("avx2")))
+void batchInverseDistanceSumAVX2(const float* x, const float* y, const int* group, int n, float px, float py, float* sums, int numGroups)
+{
+	__m256 vpx = _mm256_set1_ps(px);
+	__m256 vpy = _mm256_set1_ps(py);
+	__m256 zero = _mm256_setzero_ps();
+	__m256 one = _mm256_set1_ps(1.f);
+	__m256 acc[BATCH_MAX_GROUPS];
+	for (int g = 0; g < numGroups; g++)
+		acc[g] = zero;
+
+	int i = 0;
+	for (; i + BATCH_LANES <= n; i += BATCH_LANES)
+	{
+		__m256 dx = _mm256_sub_ps(_mm256_loadu_ps(x + i), vpx);
+		__m256 dy = _mm256_sub_ps(_mm256_loadu_ps(y + i), vpy);
+		__m256 r = _mm256_sqrt_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)));
+		__m256 valid = _mm256_cmp_ps(r, zero, _CMP_GT_OQ);
+		// r = 0 would divide by zero, those lanes are masked out anyway
+		__m256 f = _mm256_min_ps(_mm256_div_ps(one, _mm256_blendv_ps(one, r, valid)), one);
+		f = _mm256_and_ps(f, valid);
+		__m256i vg = _mm256_loadu_si256((const __m256i*) (group + i));
+		for (int g = 0; g < numGroups; g++)
+			acc[g] = _mm256_add_ps(acc[g], _mm256_and_ps(f, _mm256_castsi256_ps(_mm256_cmpeq_epi32(vg, _mm256_set1_epi32(g)))));
+	}
+	for (int g = 0; g < numGroups; g++)
+	{
+		float lanes[BATCH_LANES];
+		_mm256_storeu_ps(lanes, acc[g]);
+		sums[g] += sumLanes(lanes);
+	}
+	for (; i < n; i++)
+		sums[group[i]] += inverseDistance(x[i], y[i], px, py);
+}
+
+#endif
+
+struct BatchKernels
+{
+	const char* name;
+	int width; // floats per vector, the last n % width are done like in the scalar version (n % BATCH_LANES for the sums)
+	void (*distance)(const float* x, const float* y, float px, float py, float* out, int n);
+	void (*normalize)(float* x, float* y, int n);
+	void (*scaleAdd)(float* x, float* y, const float* dx, const float* dy, const float* scale, int n);
+	void (*inverseDistanceSum)(const float* x, const float* y, const int* group, int n, float px, float py, float* sums, int numGroups);
+};
+
+const BatchKernels batchScalar = {"scalar", 1, batchDistanceScalar, batchNormalizeScalar, batchScaleAddScalar, batchInverseDistanceSumScalar};
+#ifdef BATCH_X86
+const BatchKernels batchSSE2 = {"SSE2", 4, batchDistanceSSE2, batchNormalizeSSE2, batchScaleAddSSE2, batchInverseDistanceSumSSE2};
+const BatchKernels batchAVX2 = {"AVX2", 8, batchDistanceAVX2, batchNormalizeAVX2, batchScaleAddAVX2, batchInverseDistanceSumAVX2};
+#endif
+
+BatchKernels batch = batchScalar;
+
+inline void batchDistance(const float* x, const float* y, float px, float py, float* out, int n)
+{
+	batch.distance(x, y, px, py, out, n);
+}
+
+inline void batchNormalize(float* x, float* y, int n)
+{
+	batch.normalize(x, y, n);
+}
+
+inline void batchScaleAdd(float* x, float* y, const float* dx, const float* dy, const float* scale, int n)
+{
+	batch.scaleAdd(x, y, dx, dy, scale, n);
+}
+
+// group values have to be in [0, numGroups), numGroups at most BATCH_MAX_GROUPS, results are added to sums
+inline void batchInverseDistanceSum(const float* x, const float* y, const int* group, int n, float px, float py, float* sums, int numGroups)
+{
+	batch.inverseDistanceSum(x, y, group, n, px, py, sums, numGroups);
+}
+
+#define BATCH_CHECK_MAX 67 // not a multiple of any vector width
+
+// runs the kernels on the first n <= BATCH_CHECK_MAX of some awkward input
+// and compares them to the scalar reference
+bool checkBatchKernels(const BatchKernels* kernels, int n = BATCH_CHECK_MAX)
+{
+	float x[BATCH_CHECK_MAX], y[BATCH_CHECK_MAX], dx[BATCH_CHECK_MAX], dy[BATCH_CHECK_MAX], scale[BATCH_CHECK_MAX];
+	float outx[BATCH_CHECK_MAX], outy[BATCH_CHECK_MAX], refx[BATCH_CHECK_MAX], refy[BATCH_CHECK_MAX];
+	int group[BATCH_CHECK_MAX];
+	for (int i = 0; i < BATCH_CHECK_MAX; i++)
+	{
+		// some exact zeros, the rest spread around the origin
+		x[i] = (i % 11 == 0) ? 0.f : (float) ((i * 37) % 101) - 50.f;
+		y[i] = (i % 11 == 0) ? 0.f : (float) ((i * 53) % 89) / 7.f - 6.f;
+		dx[i] = (float) (i % 5) - 2.f;
+		dy[i] = (float) (i % 3) * 0.25f;
+		scale[i] = 0.016f * (float) (i % 4);
+		group[i] = i % 3;
+	}
+
+	bool success = true;
+
+	memset(refx, 0, sizeof(refx));
+	memset(outx, 0, sizeof(outx));
+	batchDistanceScalar(x, y, 3.f, -2.f, refx, n);
+	kernels->distance(x, y, 3.f, -2.f, outx, n);
+	if (memcmp(outx, refx, sizeof(outx)) != 0)
+	{
+		LOG_ERROR("%s batchDistance doesn't match the scalar reference for n = %d!\n", kernels->name, n);
+		success = false;
+	}
+
+	memcpy(refx, x, sizeof(x)); memcpy(refy, y, sizeof(y));
+	memcpy(outx, x, sizeof(x)); memcpy(outy, y, sizeof(y));
+	batchNormalizeScalar(refx, refy, n);
+	kernels->normalize(outx, outy, n);
+	if (memcmp(outx, refx, sizeof(outx)) != 0 || memcmp(outy, refy, sizeof(outy)) != 0)
+	{
+		LOG_ERROR("%s batchNormalize doesn't match the scalar reference for n = %d!\n", kernels->name, n);
+		success = false;
+	}
+
+	memcpy(refx, x, sizeof(x)); memcpy(refy, y, sizeof(y));
+	memcpy(outx, x, sizeof(x)); memcpy(outy, y, sizeof(y));
+	batchScaleAddScalar(refx, refy, dx, dy, scale, n);
+	kernels->scaleAdd(outx, outy, dx, dy, scale, n);
+	if (memcmp(outx, refx, sizeof(outx)) != 0 || memcmp(outy, refy, sizeof(outy)) != 0)
+	{
+		LOG_ERROR("%s batchScaleAdd doesn't match the scalar reference for n = %d!\n", kernels->name, n);
+		success = false;
+	}
+
+	float sums[3] = {0.5f, 0.f, 2.f};
+	float refsums[3] = {0.5f, 0.f, 2.f};
+	batchInverseDistanceSumScalar(x, y, group, n, 0.f, 0.f, refsums, 3);
+	kernels->inverseDistanceSum(x, y, group, n, 0.f, 0.f, sums, 3);
+	if (memcmp(sums, refsums, sizeof(sums)) != 0)
+	{
+		LOG_ERROR("%s batchInverseDistanceSum doesn't match the scalar reference for n = %d!\n", kernels->name, n);
+		success = false;
+	}
+	return success;
+}
+
+// pick the widest batch kernels supported by this CPU
+void initBatchKernels()
+{
+	batch = batchScalar;
+#ifdef BATCH_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2") && checkBatchKernels(&batchAVX2))
+		batch = batchAVX2;
+	else if (__builtin_cpu_supports("sse2") && checkBatchKernels(&batchSSE2))
+		batch = batchSSE2;
+#endif
+	LOG_INFO("Using %s batch kernels\n", batch.name);
+}